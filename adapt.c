@@ -0,0 +1,231 @@
+/*
+ *  Adapt the number of commands in flight.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "adapt.h"
+#include "debug.h"
+
+#define adapt_reserve  64       // descriptors and processes kept for ourselves
+#define adapt_failmax  0.05     // highest tolerated transport failure rate
+#define adapt_latmax   2.0      // highest tolerated latency over the best round
+#define adapt_loadmax  1.5      // highest tolerated load average per cpu
+#define adapt_smooth   0.25     // weight of the newest round in settled
+
+/*  Ceiling allowed by a resource limit with a fixed reserve.
+*/
+static unsigned adapt_headroom(rlim_t cur, unsigned per)
+{
+    if ((cur == RLIM_INFINITY) || (cur > (rlim_t)adapt_hardmax*per + adapt_reserve))
+        return adapt_hardmax;
+
+    return cur > adapt_reserve + per ? (cur - adapt_reserve)/per : 1;
+}
+
+/*  Largest sensible number of commands in flight given the open
+    file and process limits, raising the soft open file limit to
+    the hard limit first.
+
+    Args:
+        nfd:    file descriptors held open for each command.
+
+    Returns:
+        ceiling of at least one and at most adapt_hardmax.
+*/
+unsigned adapt_ceiling(unsigned nfd)
+{
+    struct rlimit rl;
+    unsigned max = adapt_hardmax, n;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < rl.rlim_max) {
+            rl.rlim_cur = rl.rlim_max;
+            if (setrlimit(RLIMIT_NOFILE, &rl) < 0)
+                getrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if ((n = adapt_headroom(rl.rlim_cur, nfd)) < max)
+            max = n;
+    }
+
+    if ((getrlimit(RLIMIT_NPROC, &rl) == 0) &&
+            ((n = adapt_headroom(rl.rlim_cur, 1)) < max))
+        max = n;
+
+    debug_print(2, "adaptive ceiling: %u", max);
+
+    return max;
+}
+
+/*  Setup a controller.
+
+    Args:
+        a:      controller to setup.
+
+        start:  initial limit.
+
+        max:    ceiling on limit.
+*/
+void adapt_init(adapt *a, unsigned start, unsigned max)
+{
+    a->max       = max;
+    a->limit     = start < max ? start : max;
+    a->peak      = a->limit;
+    a->slowstart = true;
+    a->ndone     = a->nfail = a->nlat = a->nrounds = 0;
+    a->latsum    = a->base = 0.0;
+    a->settled   = a->limit;
+}
+
+/*  True if the local machine is loaded beyond adapt_loadmax.
+*/
+static bool adapt_overloaded()
+{
+    double load;
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if ((getloadavg(&load, 1) < 1) || (ncpu < 1))
+        return false;
+
+    return load > adapt_loadmax*ncpu;
+}
+
+/*  Set a new limit within bounds.
+*/
+static void adapt_set(adapt *a, unsigned limit)
+{
+    if (limit < 1)
+        limit = 1;
+    if (limit > a->max)
+        limit = a->max;
+
+    if (limit != a->limit)
+        debug_print(3, "adaptive limit: %u -> %u", a->limit, limit);
+
+    a->limit = limit;
+    if (limit > a->peak)
+        a->peak = limit;
+}
+
+/*  Halve the limit at once, eg, because a command could not be
+    launched for lack of local resources.
+
+    Args:
+        a:      controller.
+*/
+void adapt_backoff(adapt *a)
+{
+    a->slowstart = false;
+    adapt_set(a, a->limit/2);
+}
+
+/*  Record a finished command and revise the limit at the end
+    of a round.  The limit is halved if transport failures, the
+    latency relative to the best round seen or the local load
+    average are too high and is raised otherwise.
+
+    Args:
+        a:      controller.
+
+        ms:     time from launch to the first output in
+                milliseconds, which stands for the connection
+                latency, negative if the command printed nothing.
+
+        failed: true if the transport failed to reach the host.
+*/
+void adapt_done(adapt *a, double ms, bool failed)
+{
+    double mean;
+    bool congested;
+
+    ++a->ndone;
+    if (ms >= 0.0) {
+        a->latsum += ms;
+        ++a->nlat;
+    }
+    if (failed)
+        ++a->nfail;
+
+    if (a->ndone < a->limit)
+        return;
+
+    mean = a->nlat > 0 ? a->latsum/a->nlat : 0.0;
+
+    if (a->nfail > adapt_failmax*a->ndone) {
+        debug_print(2, "adaptive: %u of %u failed", a->nfail, a->ndone);
+        congested = true;
+    }
+    else if ((a->nlat > 0) && (a->base > 0.0) && (mean > adapt_latmax*a->base)) {
+        debug_print(2, "adaptive: latency %.1f ms against %.1f ms", mean, a->base);
+        congested = true;
+    }
+    else if (adapt_overloaded()) {
+        debug_print(2, "adaptive: load average too high");
+        congested = true;
+    }
+    else
+        congested = false;
+
+    // only successful rounds count towards the baseline latency
+    if ((a->nfail == 0) && (a->nlat > 0) && ((a->base == 0.0) || (mean < a->base)))
+        a->base = mean;
+
+    if (congested)
+        adapt_backoff(a);
+    else if (a->slowstart)
+        adapt_set(a, a->limit*2);
+    else
+        adapt_set(a, a->limit+1);
+
+    a->settled = a->nrounds++ == 0 ? a->limit :
+        adapt_smooth*a->limit + (1.0-adapt_smooth)*a->settled;
+
+    a->ndone = a->nfail = a->nlat = 0;
+    a->latsum = 0.0;
+}
+
+/*  Print the limit the controller settled on.
+
+    Args:
+        a:      controller.
+*/
+void adapt_report(const adapt *a)
+{
+    debug_print(1, "adaptive parallelism settled on %.0f after %u rounds, peak %u of %u",
+                a->settled, a->nrounds, a->peak, a->max);
+}
@@ -0,0 +1,111 @@
+/*
+ *  Adapt the number of commands in flight.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+#ifndef adapt_h
+    #define adapt_h
+
+    #include <stdbool.h>
+
+    #define adapt_hardmax 4096  // most commands in flight regardless of limits
+
+    /* additive increase, multiplicative decrease controller, the
+       limit is revised each round of limit finished commands */
+    typedef struct {
+        unsigned limit;     // commands currently allowed in flight
+        unsigned max;       // ceiling on limit
+        unsigned peak;      // highest limit reached
+        bool     slowstart; // doubling each round until the first decrease
+        unsigned ndone;     // commands finished this round
+        unsigned nfail;     // transport failures this round
+        unsigned nlat;      // latencies measured this round
+        double   latsum;    // summed latency this round in milliseconds
+        double   base;      // lowest mean round latency, 0 before any round
+        double   settled;   // moving average of limit over rounds
+        unsigned nrounds;   // rounds completed
+    } adapt;
+
+    /*  Largest sensible number of commands in flight given the open
+        file and process limits, raising the soft open file limit to
+        the hard limit first.
+
+        Args:
+            nfd:    file descriptors held open for each command.
+
+        Returns:
+            ceiling of at least one and at most adapt_hardmax.
+    */
+    unsigned adapt_ceiling(unsigned nfd);
+
+    /*  Setup a controller.
+
+        Args:
+            a:      controller to setup.
+
+            start:  initial limit.
+
+            max:    ceiling on limit.
+    */
+    void adapt_init(adapt *a, unsigned start, unsigned max);
+
+    /*  Record a finished command and revise the limit at the end
+        of a round.  The limit is halved if transport failures, the
+        latency relative to the best round seen or the local load
+        average are too high and is raised otherwise.
+
+        Args:
+            a:      controller.
+
+            ms:     time from launch to the first output in
+                    milliseconds, which stands for the connection
+                    latency, negative if the command printed nothing.
+
+            failed: true if the transport failed to reach the host.
+    */
+    void adapt_done(adapt *a, double ms, bool failed);
+
+    /*  Halve the limit at once, eg, because a command could not be
+        launched for lack of local resources.
+
+        Args:
+            a:      controller.
+    */
+    void adapt_backoff(adapt *a);
+
+    /*  Print the limit the controller settled on.
+
+        Args:
+            a:      controller.
+    */
+    void adapt_report(const adapt *a);
+
+#endif
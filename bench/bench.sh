@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+#  Benchmark sshall against a fake ssh.
+#
+#  Each scenario runs sshall over a generated host list with the stub
+#  in bench/bin standing in for ssh and reports the wall time, the
+#  overhead per host beyond the configured latency, the peak RSS and
+#  the peak number of processes.  Set BENCH_FULL=1 to include the
+#  50000 host scenarios.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+PATH="$PWD/bench/bin:$PATH"
+export PATH
+
+# room for -p 2000
+ulimit -n 16384 2>/dev/null || ulimit -n 8192 2>/dev/null
+
+hosts=$(mktemp) || exit 1
+trap 'rm -f "$hosts"' EXIT
+
+printf '%-8s %6s %5s %9s %7s %7s %9s %11s %9s %6s\n' \
+    mode hosts npar bytes connect runtime wall_s overhead_ms rss_kb procs
+
+# mode hosts npar bytes connect runtime
+scenario()
+{
+    mode=$1 n=$2 p=$3 bytes=$4 connect=$5 runtime=$6
+
+    seq -f 'host%g' "$n" > "$hosts"
+
+    if [ "$mode" = seq ]; then
+        set -- -q -f "$hosts" true
+        waves=$n
+    else
+        set -- -q -p"$p" -f "$hosts" true
+        waves=$(( (n + p - 1) / p ))
+    fi
+
+    stat=$(FAKESSH_BYTES=$bytes FAKESSH_CONNECT=$connect FAKESSH_RUNTIME=$runtime \
+        bench/runstat ./sshall "$@" 2>&1 >/dev/null | tail -n 1)
+    set -- $stat
+
+    printf '%-8s %6d %5s %9d %7s %7s %9s %11s %9s %6s\n' \
+        "$mode" "$n" "$p" "$bytes" "$connect" "$runtime" "$1" \
+        "$(echo "$1 $waves $connect $runtime $n" | \
+            awk '{ printf "%.3f", ($1 - $2*($3+$4))*1000/$5 }')" \
+        "$2" "$3"
+}
+
+# process overhead with tiny output
+scenario seq      1000    1      64 0 0
+scenario par      1000    1      64 0 0
+scenario par      1000   10      64 0 0
+scenario par      1000  100      64 0 0
+scenario par     10000  100      64 0 0
+scenario par     10000  500      64 0 0
+scenario par     10000 2000      64 0 0
+
+# latency bound hosts
+scenario par      1000  100      64 0.05 0.1
+scenario par     10000 2000      64 0.05 0.1
+
+# huge output
+scenario seq        20    1 4194304 0 0
+scenario par       100   10 4194304 0 0
+scenario par      1000  500 1048576 0 0
+
+if [ -n "$BENCH_FULL" ]; then
+    scenario par     50000  500      64 0 0
+    scenario par     50000 2000      64 0 0
+    scenario par     50000 2000      64 0.05 0.1
+fi
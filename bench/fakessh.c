@@ -0,0 +1,109 @@
+/*
+ *  Stand in for ssh when benchmarking sshall.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+/*
+    Ignores its options and command, then behaves as configured by
+    the environment:
+
+        FAKESSH_CONNECT  seconds to wait before any output, default 0
+        FAKESSH_RUNTIME  seconds to wait after the output, default 0
+        FAKESSH_BYTES    bytes of output to write, default 64
+        FAKESSH_EXIT     exit status, default 0
+
+    A status of 255 writes a connection error to standard error
+    instead of any output, like a refused ssh connection.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define fakessh_line 64     // length of each output line
+
+/*  Read a number from the environment.
+*/
+double fakessh_env(const char *name, double def)
+{
+    const char *val = getenv(name);
+    return val != NULL ? strtod(val, NULL) : def;
+}
+
+/*  Sleep for a fractional number of seconds.
+*/
+void fakessh_sleep(double sec)
+{
+    struct timespec ts;
+
+    if (sec <= 0.0)
+        return;
+
+    ts.tv_sec  = (time_t)sec;
+    ts.tv_nsec = (long)((sec - ts.tv_sec)*1000000000.0);
+    nanosleep(&ts, NULL);
+}
+
+int main(int narg, char *arg[])
+{
+    double connect = fakessh_env("FAKESSH_CONNECT", 0.0);
+    double runtime = fakessh_env("FAKESSH_RUNTIME", 0.0);
+    long   bytes   = (long)fakessh_env("FAKESSH_BYTES", 64.0);
+    int    status  = (int)fakessh_env("FAKESSH_EXIT", 0.0);
+    const char *host = narg > 2 ? arg[narg-2] : "localhost";
+    char buff[65536];
+    size_t i;
+
+    fakessh_sleep(connect);
+
+    if (status == 255) {
+        fprintf(stderr, "ssh: connect to host %s port 22: Connection refused\n", host);
+        return status;
+    }
+
+    // lines of the host name padded with dots
+    for (i = 0; i < sizeof(buff); ++i)
+        buff[i] = (i % fakessh_line) == fakessh_line-1 ? '\n' : '.';
+    for (i = 0; i < sizeof(buff); i += fakessh_line)
+        memcpy(buff+i, host, strnlen(host, fakessh_line/2));
+
+    while (bytes > 0) {
+        ssize_t w = write(STDOUT_FILENO, buff, bytes < (long)sizeof(buff) ? bytes : (long)sizeof(buff));
+        if (w < 0)
+            return EXIT_FAILURE;
+        bytes -= w;
+    }
+
+    fakessh_sleep(runtime);
+
+    return status;
+}
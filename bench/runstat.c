@@ -0,0 +1,138 @@
+/*
+ *  Run a command and report its wall time, peak RSS and process count.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+/*
+    Usage: runstat command [args...]
+
+    Prints "wall_seconds peak_rss_kb peak_processes" on standard error
+    once the command exits.  Processes are counted by sampling /proc
+    for the command and everything below it every few milliseconds.
+*/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define runstat_maxpid  4194304     // largest pid tracked
+#define runstat_sample 10000000     // nanoseconds between samples
+
+/*  Count the processes descended from root, including root.
+*/
+unsigned runstat_count(pid_t root, pid_t *parent)
+{
+    struct dirent *d;
+    unsigned n = 0;
+    DIR *proc;
+    pid_t id, p;
+
+    if ((proc = opendir("/proc")) == NULL)
+        return 0;
+
+    // record the parent of every process
+    while ((d = readdir(proc)) != NULL) {
+        char path[64], buff[512], *c;
+        FILE *f;
+
+        if ((id = atoi(d->d_name)) <= 0 || id >= runstat_maxpid)
+            continue;
+
+        snprintf(path, sizeof(path), "/proc/%d/stat", id);
+        if ((f = fopen(path, "r")) == NULL)
+            continue;
+
+        parent[id] = 0;
+        if ((fgets(buff, sizeof(buff), f) != NULL) &&
+            ((c = strrchr(buff, ')')) != NULL))
+            sscanf(c+2, "%*c %d", &parent[id]);
+        fclose(f);
+    }
+
+    // walk up from each process looking for root
+    rewinddir(proc);
+    while ((d = readdir(proc)) != NULL) {
+        if ((id = atoi(d->d_name)) <= 0 || id >= runstat_maxpid)
+            continue;
+
+        for (p = id; (p > 1) && (p != root) && (p < runstat_maxpid); p = parent[p]);
+        if (p == root)
+            ++n;
+    }
+
+    closedir(proc);
+    return n;
+}
+
+int main(int narg, char *arg[])
+{
+    struct timespec start, end, nap = {0, runstat_sample};
+    struct rusage ru;
+    unsigned n, peak = 0;
+    pid_t *parent, id;
+    int status = 0;
+
+    if (narg < 2) {
+        fprintf(stderr, "Usage: %s command [args...]\n", arg[0]);
+        return EXIT_FAILURE;
+    }
+
+    if ((parent = calloc(runstat_maxpid, sizeof(pid_t))) == NULL)
+        return EXIT_FAILURE;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ((id = fork()) == 0) {
+        execvp(arg[1], arg+1);
+        perror(arg[1]);
+        _exit(127);
+    }
+
+    while (waitpid(id, &status, WNOHANG) == 0) {
+        if ((n = runstat_count(id, parent)) > peak)
+            peak = n;
+        nanosleep(&nap, NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    getrusage(RUSAGE_CHILDREN, &ru);
+
+    fprintf(stderr, "%.3f %ld %u\n",
+            (end.tv_sec-start.tv_sec) + (end.tv_nsec-start.tv_nsec)/1e9,
+            ru.ru_maxrss, peak);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
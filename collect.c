@@ -0,0 +1,172 @@
+/*
+ *  Collect finished hosts and print them in order.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#include <stdlib.h>
+
+#include "collect.h"
+#include "debug.h"
+
+static collect_order   collect_ord = collect_completion;
+static void          (*collect_print)(sched_job *j) = NULL;
+static sched_job      *collect_ring = NULL;     // hosts held back, by index modulo window
+static unsigned        collect_window = 0;      // size of collect_ring
+static unsigned        collect_next = 0;        // index of next host to print
+static unsigned        collect_nheld = 0;       // number of hosts in collect_ring
+
+/*  Setup the collector, which must be done before collect_add.
+
+    Args:
+        order:  order in which to print finished hosts.
+
+        window: number of finished hosts that may be held back
+                waiting for an earlier host in input order.
+
+        print:  called to print each host, in order.
+*/
+void collect_init(collect_order order, unsigned window,
+                  void (*print)(sched_job *j))
+{
+    unsigned i;
+
+    collect_ord    = order;
+    collect_print  = print;
+    collect_window = window > 0 ? window : 1;
+    collect_next   = collect_nheld = 0;
+
+    if (order != collect_input)
+        return;
+
+    if ((collect_ring = malloc(sizeof(sched_job)*collect_window)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    for (i = 0; i < collect_window; ++i)
+        collect_ring[i].host = NULL;
+}
+
+/*  Print a host and free what it holds.
+*/
+static void collect_emit(sched_job *j)
+{
+    collect_print(j);
+
+    free(j->host);
+    outbuf_free(&j->out);
+    j->host = NULL;
+}
+
+/*  Print held hosts from the front of the window until
+    reaching one that has not finished yet.
+*/
+static void collect_drain()
+{
+    sched_job *j;
+
+    while ((j = &collect_ring[collect_next % collect_window])->host != NULL) {
+        collect_emit(j);
+        --collect_nheld;
+        ++collect_next;
+    }
+}
+
+/*  Hand a finished host to the collector, which prints it now or
+    once all earlier hosts have been printed.  Takes ownership of
+    j->host and j->out, matching sched_opts.done.
+
+    In input order, a host that finishes more than window places
+    ahead of the oldest unfinished host forces that host out of
+    order, rather than holding up any launches.  Jobs that are
+    not hosts of the input, with index sched_noindex, print at once.
+
+    Args:
+        j:  finished host.
+*/
+void collect_add(sched_job *j)
+{
+    sched_job held = *j;
+
+    // the scheduler no longer owns these
+    j->host = NULL;
+    outbuf_init(&j->out);
+
+    // printed late after being skipped, or order does not matter
+    if ((collect_ord == collect_completion) || (held.index < collect_next) ||
+            (held.index == sched_noindex)) {
+        collect_emit(&held);
+        return;
+    }
+
+    // slide the window past unfinished hosts, they print when they finish
+    while (held.index >= collect_next + collect_window) {
+        sched_job *front = &collect_ring[collect_next % collect_window];
+
+        if (front->host != NULL) {
+            collect_emit(front);
+            --collect_nheld;
+        }
+        else
+            debug_print(2, "reorder window full, host %u will print out of order",
+                        collect_next);
+
+        ++collect_next;
+    }
+
+    // a repeated index must not take the place of the host held there
+    if (collect_ring[held.index % collect_window].host != NULL) {
+        debug_warn("Host %u finished twice, printing it out of order", held.index);
+        collect_emit(&held);
+        return;
+    }
+
+    collect_ring[held.index % collect_window] = held;
+    ++collect_nheld;
+
+    collect_drain();
+}
+
+/*  Print any hosts still held back and free the collector.
+*/
+void collect_flush()
+{
+    if (collect_ring != NULL) {
+        while (collect_nheld > 0) {
+            sched_job *j = &collect_ring[collect_next++ % collect_window];
+
+            if (j->host != NULL) {
+                collect_emit(j);
+                --collect_nheld;
+            }
+        }
+
+        free(collect_ring);
+        collect_ring = NULL;
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ *  Collect finished hosts and print them in order.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef collect_h
+    #define collect_h
+
+    #include "sched.h"
+
+    #define collect_window_default 256  // default size of the reorder window
+
+    /* order in which finished hosts are printed */
+    typedef enum {
+        collect_completion,     // as soon as each host finishes
+        collect_input           // in the order hosts were given
+    } collect_order;
+
+    /*  Setup the collector, which must be done before collect_add.
+
+        Args:
+            order:  order in which to print finished hosts.
+
+            window: number of finished hosts that may be held back
+                    waiting for an earlier host in input order.
+
+            print:  called to print each host, in order.
+    */
+    void collect_init(collect_order order, unsigned window,
+                      void (*print)(sched_job *j));
+
+    /*  Hand a finished host to the collector, which prints it now or
+        once all earlier hosts have been printed.  Takes ownership of
+        j->host and j->out, matching sched_opts.done.
+
+        In input order, a host that finishes more than window places
+        ahead of the oldest unfinished host forces that host out of
+        order, rather than holding up any launches.  Jobs that are
+        not hosts of the input, with index sched_noindex, print at once.
+
+        Args:
+            j:  finished host.
+    */
+    void collect_add(sched_job *j);
+
+    /*  Print any hosts still held back and free the collector.
+    */
+    void collect_flush();
+
+#endif
@@ -42,14 +42,53 @@
 */
 void color_set(int tx, int fg, int bg)
 {
-    if (bg <= 0)
-        printf("%c[%d;%dm", col_esc, tx, fg);
-    else
-        printf("%c[%d;%d;%dm", col_esc, tx, fg, bg);
+    char str[color_maxlen];
+
+    color_sset(str, sizeof(str), tx, fg, bg);
+    fputs(str, stdout);
 }
 
 /*  Reset colors back to default. */
 void color_reset()
 {
-    printf("%c[%dm", col_esc, col_res);
+    char str[color_maxlen];
+
+    color_sreset(str, sizeof(str));
+    fputs(str, stdout);
+}
+
+/*  Format the escape sequence that sets the current color
+    scheme into str, like snprintf.
+
+    Args:
+        str:  buffer of at least color_maxlen characters.
+        size: size of str.
+        tx:   text color
+        fg:   foreground color
+        bg:   background color
+
+    Returns:
+        number of characters written, not including the null.
+*/
+int color_sset(char *str, size_t size, int tx, int fg, int bg)
+{
+    if (bg <= 0)
+        return snprintf(str, size, "%c[%d;%dm", col_esc, tx, fg);
+    else
+        return snprintf(str, size, "%c[%d;%d;%dm", col_esc, tx, fg, bg);
+}
+
+/*  Format the escape sequence that resets colors into str,
+    like snprintf.
+
+    Args:
+        str:  buffer of at least color_maxlen characters.
+        size: size of str.
+
+    Returns:
+        number of characters written, not including the null.
+*/
+int color_sreset(char *str, size_t size)
+{
+    return snprintf(str, size, "%c[%dm", col_esc, col_res);
 }
@@ -32,10 +32,15 @@
 #ifndef colorset_h
     #define colorset_h
 
+    #include <stddef.h>
+
     // color codes
     #define col_esc    0x1b     // escape sequence
     #define col_res    0        // reset colors
 
+    // longest escape sequence including the terminating null
+    #define color_maxlen 16
+
     /*  Set current color scheme.
 
         Args:
@@ -48,4 +53,31 @@
     /*  Reset colors back to default. */
     void color_reset();
 
+    /*  Format the escape sequence that sets the current color
+        scheme into str, like snprintf.
+
+        Args:
+            str:  buffer of at least color_maxlen characters.
+            size: size of str.
+            tx:   text color
+            fg:   foreground color
+            bg:   background color
+
+        Returns:
+            number of characters written, not including the null.
+    */
+    int color_sset(char *str, size_t size, int tx, int fg, int bg);
+
+    /*  Format the escape sequence that resets colors into str,
+        like snprintf.
+
+        Args:
+            str:  buffer of at least color_maxlen characters.
+            size: size of str.
+
+        Returns:
+            number of characters written, not including the null.
+    */
+    int color_sreset(char *str, size_t size);
+
 #endif
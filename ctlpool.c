@@ -0,0 +1,221 @@
+/*
+ *  Pool of persistent ssh ControlMaster connections.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ctlpool.h"
+#include "debug.h"
+#include "spawn.h"
+
+static char *ctlpool_dir = NULL;        // directory holding control sockets
+static char *ctlpool_path = NULL;       // ControlPath option
+static char *ctlpool_persist = NULL;    // ControlPersist option
+
+/*  Setup the pool, creating the directory that holds the control
+    sockets, $XDG_RUNTIME_DIR/sshall or else ~/.ssh/sshall.
+
+    Args:
+        persist:    how long idle masters stay up, in any
+                    format accepted by ssh ControlPersist.
+*/
+void ctlpool_init(const char *persist)
+{
+    const char *base = getenv("XDG_RUNTIME_DIR");
+    struct stat st;
+    int r = -1;
+
+    if (base != NULL)
+        r = asprintf(&ctlpool_dir, "%s/sshall", base);
+    else if ((base = getenv("HOME")) != NULL)
+        r = asprintf(&ctlpool_dir, "%s/.ssh/sshall", base);
+    else
+        debug_fail("Neither XDG_RUNTIME_DIR nor HOME is set for the connection pool");
+
+    if (r < 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    if ((mkdir(ctlpool_dir, 0700) < 0) && (errno != EEXIST))
+        debug_fail_errno("Failed to create %s", ctlpool_dir);
+
+    // others must not be able to plant sockets for us to use
+    if ((lstat(ctlpool_dir, &st) < 0) || !S_ISDIR(st.st_mode) ||
+        (st.st_uid != getuid()) || ((st.st_mode & 077) != 0))
+        debug_fail("%s must be a directory private to this user", ctlpool_dir);
+
+    // %C is a hash of the connection, short enough for any socket path
+    if ((asprintf(&ctlpool_path, "-oControlPath=%s/%%C", ctlpool_dir) < 0) ||
+        (asprintf(&ctlpool_persist, "-oControlPersist=%s", persist) < 0))
+        debug_fail_errno("Failed to allocate memory");
+
+    debug_print(2, "connection pool in %s", ctlpool_dir);
+}
+
+/*  Arguments that make ssh reuse a pooled master if one is up
+    but never become a master itself, so no detached master
+    holds the output pipes of a command.
+
+    Returns:
+        NULL terminated arguments to pass to ssh.
+*/
+char **ctlpool_args()
+{
+    static char *args[3];
+
+    args[0] = "-oControlMaster=no";
+    args[1] = ctlpool_path;
+    args[2] = NULL;
+
+    return args;
+}
+
+/*  Arguments that send a control command, eg, check or exit,
+    to the master for a host.
+
+    Args:
+        op: control command given to ssh -O.
+
+    Returns:
+        NULL terminated arguments to pass to ssh.
+*/
+char **ctlpool_ctl_args(char *op)
+{
+    static char *args[4];
+
+    args[0] = ctlpool_path;
+    args[1] = "-O";
+    args[2] = op;
+    args[3] = NULL;
+
+    return args;
+}
+
+/*  Start a master for every host that does not have one, up to
+    npar at a time.  Masters outlive this process and close their
+    standard streams.
+
+    Args:
+        argv:   ssh and its arguments, NULL terminated.
+
+        next:   returns the next host or NULL when done.
+
+        npar:   number of masters to start at once.
+*/
+void ctlpool_warm(char **argv, char *(*next)(), unsigned npar)
+{
+    unsigned nargs, nrunning = 0, nhosts = 0, nready = 0, i;
+    char **arg, *host;
+    int status, null;
+    pid_t *pids, id;
+
+    for (nargs = 0; argv[nargs] != NULL; ++nargs);
+    if (((arg = malloc(sizeof(char*)*(nargs+6))) == NULL) ||
+            ((pids = malloc(sizeof(pid_t)*npar)) == NULL))
+        debug_fail_errno("Failed to allocate memory");
+
+    // an existing master just runs true, otherwise this one
+    // becomes the master and stays up after true exits
+    memcpy(arg, argv, sizeof(char*)*nargs);
+    arg[nargs]   = "-oControlMaster=auto";
+    arg[nargs+1] = ctlpool_path;
+    arg[nargs+2] = ctlpool_persist;
+    arg[nargs+4] = "true";
+    arg[nargs+5] = NULL;
+
+    // a detached master must not hold anything of ours open
+    if ((null = open("/dev/null", O_RDWR | O_CLOEXEC, 0x0)) < 0)
+        debug_fail_errno("Failed to open /dev/null");
+
+    debug_print(1, "warming connection pool");
+
+    while (true) {
+        if ((nrunning < npar) && ((host = next()) != NULL)) {
+            arg[nargs+3] = host;
+            if ((id = spawn_cmd(arg, null, null, null)) < 0)
+                debug_warn_errno("Failed to spawn %s", arg[0]);
+            else {
+                pids[nrunning++] = id;
+                ++nhosts;
+            }
+            continue;
+        }
+
+        if (nrunning == 0)
+            break;
+
+        // whichever finishes first frees its slot
+        if ((id = waitpid(-1, &status, 0)) < 0) {
+            if (errno == EINTR)
+                continue;
+            debug_fail_errno("Failed to wait for connection pool");
+        }
+
+        for (i = 0; (i < nrunning) && (pids[i] != id); ++i);
+        if (i == nrunning) {
+            debug_print(3, "reaped unknown child %d", id);
+            continue;
+        }
+
+        pids[i] = pids[--nrunning];
+        if (status == 0)
+            ++nready;
+    }
+
+    debug_print(1, "connection pool ready for %u of %u hosts", nready, nhosts);
+
+    close(null);
+    free(pids);
+    free(arg);
+}
+
+/*  Remove the socket directory if no masters are left in it.
+*/
+void ctlpool_cleanup()
+{
+    if (rmdir(ctlpool_dir) == 0)
+        return;
+
+    if ((errno == ENOTEMPTY) || (errno == EEXIST))
+        debug_print(2, "masters still running in %s", ctlpool_dir);
+    else
+        debug_warn_errno("Failed to remove %s", ctlpool_dir);
+}
@@ -0,0 +1,84 @@
+/*
+ *  Pool of persistent ssh ControlMaster connections.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef ctlpool_h
+    #define ctlpool_h
+
+    #define ctlpool_persist_default "10m"   // default idle time before masters exit
+
+    /*  Setup the pool, creating the directory that holds the control
+        sockets, $XDG_RUNTIME_DIR/sshall or else ~/.ssh/sshall.
+
+        Args:
+            persist:    how long idle masters stay up, in any
+                        format accepted by ssh ControlPersist.
+    */
+    void ctlpool_init(const char *persist);
+
+    /*  Arguments that make ssh reuse a pooled master if one is up
+        but never become a master itself, so no detached master
+        holds the output pipes of a command.
+
+        Returns:
+            NULL terminated arguments to pass to ssh.
+    */
+    char **ctlpool_args();
+
+    /*  Arguments that send a control command, eg, check or exit,
+        to the master for a host.
+
+        Args:
+            op: control command given to ssh -O.
+
+        Returns:
+            NULL terminated arguments to pass to ssh.
+    */
+    char **ctlpool_ctl_args(char *op);
+
+    /*  Start a master for every host that does not have one, up to
+        npar at a time.  Masters outlive this process and close their
+        standard streams.
+
+        Args:
+            argv:   ssh and its arguments, NULL terminated.
+
+            next:   returns the next host or NULL when done.
+
+            npar:   number of masters to start at once.
+    */
+    void ctlpool_warm(char **argv, char *(*next)(), unsigned npar);
+
+    /*  Remove the socket directory if no masters are left in it.
+    */
+    void ctlpool_cleanup();
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ *  Group hosts that printed identical output.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "group.h"
+#include "debug.h"
+
+#define group_digitmax 18   // most digits taken as a number
+
+/* consecutively numbered host names, prefix[lo-hi]suffix */
+typedef struct {
+    char          *prefix;  // text before the number, or the whole name
+    char          *suffix;  // text after the number, NULL if there is no number
+    unsigned long  lo;      // first number
+    unsigned long  hi;      // last number
+    int            width;   // zero padded width of numbers
+} group_run;
+
+/* hosts that printed the same output */
+typedef struct {
+    uint64_t   hash;        // hash of output
+    size_t     len;         // bytes of output
+    int        status;      // wait status shared by every host
+    outbuf     out;         // output of the first host
+    group_run *runs;        // names sorted by prefix, suffix and number
+    unsigned   nruns;       // number of runs
+    unsigned   nalloc;      // number of runs allocated
+} group_entry;
+
+static group_entry *group_list = NULL;  // groups in order of first appearance
+static unsigned     group_n = 0;        // number of groups
+static unsigned     group_nalloc = 0;   // number of groups allocated
+static unsigned    *group_table = NULL; // open addressed, index+1 into group_list
+static unsigned     group_tsize = 0;    // slots in group_table, a power of two
+
+/*  Setup grouping, which must be done before group_add.  Turns
+    on hashing of captured output.
+*/
+void group_init()
+{
+    group_n = group_nalloc = 0;
+    group_tsize = 64;
+
+    if ((group_table = calloc(group_tsize, sizeof(unsigned))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    outbuf_hash(true);
+}
+
+/*  Table slot to start looking for a key in.
+*/
+static unsigned group_slot(uint64_t hash, size_t len, int status)
+{
+    uint64_t h = hash ^ (len*0x9e3779b97f4a7c15ULL) ^ (uint64_t)(unsigned)status;
+
+    return (unsigned)(h ^ (h >> 32)) & (group_tsize-1);
+}
+
+/*  Double the table once it is half full.
+*/
+static void group_grow()
+{
+    unsigned i, slot;
+
+    if (2*group_n < group_tsize)
+        return;
+
+    free(group_table);
+    group_tsize *= 2;
+    if ((group_table = calloc(group_tsize, sizeof(unsigned))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    for (i = 0; i < group_n; ++i) {
+        group_entry *g = &group_list[i];
+
+        for (slot = group_slot(g->hash, g->len, g->status); group_table[slot] != 0;
+             slot = (slot+1) & (group_tsize-1));
+        group_table[slot] = i+1;
+    }
+}
+
+/*  Find the group of a finished host, starting a new one with
+    its output if there is none.
+*/
+static group_entry *group_find(sched_job *j)
+{
+    unsigned slot;
+    group_entry *g;
+
+    for (slot = group_slot(j->out.hash, j->out.len, j->status); group_table[slot] != 0;
+         slot = (slot+1) & (group_tsize-1)) {
+        g = &group_list[group_table[slot]-1];
+        if ((g->hash == j->out.hash) && (g->len == j->out.len) && (g->status == j->status))
+            return g;
+    }
+
+    if (group_n == group_nalloc) {
+        group_nalloc = group_nalloc > 0 ? 2*group_nalloc : 16;
+        if ((group_list = realloc(group_list, sizeof(group_entry)*group_nalloc)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+    }
+
+    g = &group_list[group_n];
+    g->hash   = j->out.hash;
+    g->len    = j->out.len;
+    g->status = j->status;
+    g->out    = j->out;
+    g->runs   = NULL;
+    g->nruns  = g->nalloc = 0;
+
+    // the scheduler no longer owns the output
+    outbuf_init(&j->out);
+
+    group_table[slot] = ++group_n;
+    group_grow();
+
+    return &group_list[group_n-1];
+}
+
+/*  Order runs by prefix, then suffix, then zero padded width,
+    then number.
+*/
+static int group_cmp(const group_run *r, const char *prefix, const char *suffix,
+                     int width, unsigned long n)
+{
+    int c;
+
+    if ((c = strcmp(r->prefix, prefix)) != 0)
+        return c;
+
+    if ((r->suffix == NULL) || (suffix == NULL))
+        return (r->suffix != NULL) - (suffix != NULL);
+
+    if ((c = strcmp(r->suffix, suffix)) != 0)
+        return c;
+
+    if (r->width != width)
+        return r->width < width ? -1 : 1;
+
+    return r->lo < n ? -1 : r->lo > n;
+}
+
+/*  True if r holds names with the same prefix, suffix and width.
+*/
+static bool group_same(const group_run *r, const char *prefix, const char *suffix, int width)
+{
+    return (strcmp(r->prefix, prefix) == 0) && (r->suffix != NULL) && (suffix != NULL) &&
+           (strcmp(r->suffix, suffix) == 0) && (r->width == width);
+}
+
+/*  Find where n belongs among the runs of g with width, setting
+    *pos to the first run not before it.  True if a run already
+    holds n or, if grow is set, was extended to hold it.
+*/
+static bool group_extend(group_entry *g, const char *prefix, const char *suffix,
+                         int width, unsigned long n, bool grow, unsigned *pos)
+{
+    unsigned lo, hi, p;
+    group_run *r;
+
+    for (lo = 0, hi = g->nruns; lo < hi;) {
+        unsigned mid = (lo+hi)/2;
+        if (group_cmp(&g->runs[mid], prefix, suffix, width, n) < 0)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    *pos = p = lo;
+
+    // a name without a number matches only itself
+    if (suffix == NULL)
+        return (p < g->nruns) && (group_cmp(&g->runs[p], prefix, NULL, 0, 0) == 0);
+
+    // continues the run before, possibly closing the gap to the next
+    if ((p > 0) && group_same(r = &g->runs[p-1], prefix, suffix, width)) {
+        if (n <= r->hi)
+            return true;
+
+        if (grow && (n == r->hi+1)) {
+            r->hi = n;
+            if ((p < g->nruns) && group_same(&g->runs[p], prefix, suffix, width) &&
+                    (g->runs[p].lo == n+1)) {
+                r->hi = g->runs[p].hi;
+                free(g->runs[p].prefix);
+                free(g->runs[p].suffix);
+                memmove(&g->runs[p], &g->runs[p+1], sizeof(group_run)*(g->nruns-p-1));
+                --g->nruns;
+            }
+            return true;
+        }
+    }
+
+    // comes just before the next run
+    if ((p < g->nruns) && group_same(r = &g->runs[p], prefix, suffix, width)) {
+        if (r->lo == n)
+            return true;
+
+        if (grow && (n+1 == r->lo)) {
+            r->lo = n;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*  Add the name of a host to the runs of g, extending or joining
+    neighbouring runs where the number continues them.  Only
+    numbers of the same zero padded width share a run, so node1,
+    node01 and node001 stay distinct.
+*/
+static void group_insert(group_entry *g, const char *name)
+{
+    size_t len = strlen(name), end, start;
+    char *prefix, *suffix = NULL;
+    unsigned long n = 0;
+    unsigned p, q;
+    bool padded;
+    int width = 0;
+
+    // the last number in the name, eg, the 07 of node07.example.com
+    for (end = len; (end > 0) && !isdigit((unsigned char)name[end-1]); --end);
+    for (start = end; (start > 0) && isdigit((unsigned char)name[start-1]); --start);
+
+    if ((end > start) && (end-start <= group_digitmax)) {
+        n = strtoul(name+start, NULL, 10);
+        if ((name[start] == '0') && (end-start > 1))
+            width = end-start;
+        if ((prefix = strndup(name, start)) == NULL || (suffix = strdup(name+end)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+    }
+    else if ((prefix = strdup(name)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    // a number without leading zeros also belongs with padded ones
+    // of its own length, eg, node10 after node[01-09]
+    padded = (suffix != NULL) && (width == 0) && (end-start > 1);
+
+    if (group_extend(g, prefix, suffix, width, n, false, &p) ||
+            (padded && group_extend(g, prefix, suffix, end-start, n, false, &q)) ||
+            group_extend(g, prefix, suffix, width, n, true, &p) ||
+            (padded && group_extend(g, prefix, suffix, end-start, n, true, &q)))
+        goto repeated;
+
+    if (g->nruns == g->nalloc) {
+        g->nalloc = g->nalloc > 0 ? 2*g->nalloc : 4;
+        if ((g->runs = realloc(g->runs, sizeof(group_run)*g->nalloc)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+    }
+
+    memmove(&g->runs[p+1], &g->runs[p], sizeof(group_run)*(g->nruns-p));
+    g->runs[p].prefix = prefix;
+    g->runs[p].suffix = suffix;
+    g->runs[p].lo = g->runs[p].hi = n;
+    g->runs[p].width = width;
+    ++g->nruns;
+    return;
+
+    // the name is already held by a run
+repeated:
+    free(prefix);
+    free(suffix);
+}
+
+/*  Add a finished host to the group of hosts that printed the
+    same output with the same exit status, starting a new group
+    if there is none.  Only the first output of each group is
+    kept and host names are merged into numbered ranges as they
+    arrive, so memory grows with the number of distinct outputs
+    rather than hosts.  Outputs are compared by length and a
+    64 bit hash.  Takes ownership of j->out for new groups,
+    matching sched_opts.done.
+
+    Args:
+        j:  finished host.
+*/
+void group_add(sched_job *j)
+{
+    group_insert(group_find(j), j->host);
+}
+
+/*  Write the runs of g as a range pattern into a new string.
+*/
+static char *group_names(const group_entry *g)
+{
+    unsigned i, k;
+    size_t size;
+    char *names;
+    FILE *f;
+
+    if ((f = open_memstream(&names, &size)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    for (i = 0; i < g->nruns; i = k) {
+        const group_run *r = &g->runs[i];
+
+        // runs sharing a prefix and suffix go in one list, whatever their width
+        for (k = i+1; (k < g->nruns) && group_same(&g->runs[k], r->prefix, r->suffix,
+                                                   g->runs[k].width); ++k);
+
+        if (i > 0)
+            fputc(',', f);
+
+        if (r->suffix == NULL)
+            fputs(r->prefix, f);
+
+        else if ((k == i+1) && (r->lo == r->hi))
+            fprintf(f, "%s%0*lu%s", r->prefix, r->width, r->lo, r->suffix);
+
+        else {
+            unsigned m;
+
+            fprintf(f, "%s[", r->prefix);
+            for (m = i; m < k; ++m) {
+                const group_run *q = &g->runs[m];
+
+                fprintf(f, m > i ? ",%0*lu" : "%0*lu", q->width, q->lo);
+                if (q->hi > q->lo)
+                    fprintf(f, "-%0*lu", q->width, q->hi);
+            }
+            fprintf(f, "]%s", r->suffix);
+        }
+    }
+
+    if (fclose(f) != 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    return names;
+}
+
+/*  Print every group in order of first appearance, then free
+    them.  Each is passed to print with the hosts in j->host as
+    a range pattern, eg, node[01-08,10],login1.
+
+    Args:
+        print:  called to print each group.
+*/
+void group_flush(void (*print)(sched_job *j))
+{
+    unsigned i, k;
+
+    debug_print(2, "%u distinct outputs", group_n);
+
+    for (i = 0; i < group_n; ++i) {
+        group_entry *g = &group_list[i];
+        sched_job j;
+
+        memset(&j, 0, sizeof(j));
+        j.host   = group_names(g);
+        j.status = g->status;
+        j.out    = g->out;
+
+        print(&j);
+
+        free(j.host);
+        outbuf_free(&g->out);
+        for (k = 0; k < g->nruns; ++k) {
+            free(g->runs[k].prefix);
+            free(g->runs[k].suffix);
+        }
+        free(g->runs);
+    }
+
+    free(group_list);
+    free(group_table);
+    group_list = NULL;
+    group_table = NULL;
+    group_n = group_nalloc = group_tsize = 0;
+}
@@ -0,0 +1,67 @@
+/*
+ *  Group hosts that printed identical output.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+#ifndef group_h
+    #define group_h
+
+    #include "sched.h"
+
+    /*  Setup grouping, which must be done before group_add.  Turns
+        on hashing of captured output.
+    */
+    void group_init();
+
+    /*  Add a finished host to the group of hosts that printed the
+        same output with the same exit status, starting a new group
+        if there is none.  Only the first output of each group is
+        kept and host names are merged into numbered ranges as they
+        arrive, so memory grows with the number of distinct outputs
+        rather than hosts.  Outputs are compared by length and a
+        64 bit hash.  Takes ownership of j->out for new groups,
+        matching sched_opts.done.
+
+        Args:
+            j:  finished host.
+    */
+    void group_add(sched_job *j);
+
+    /*  Print every group in order of first appearance, then free
+        them.  Each is passed to print with the hosts in j->host as
+        a range pattern, eg, node[01-08,10],login1.
+
+        Args:
+            print:  called to print each group.
+    */
+    void group_flush(void (*print)(sched_job *j));
+
+#endif
@@ -0,0 +1,368 @@
+/*
+ *  Load host lists in bulk.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "hostlist.h"
+#include "debug.h"
+
+#define hostlist_block (1UL << 20)  // initial size of reads from streams
+
+/* character classes used while scanning */
+enum {
+    hostlist_name = 0,  // part of a host name
+    hostlist_space,     // separates host names
+    hostlist_comment    // starts a comment
+};
+
+/* class of every byte, built on first use */
+static unsigned char hostlist_class[256];
+
+/*  Initialize an empty hostlist.
+
+    Args:
+        l:  hostlist to initialize.
+*/
+void hostlist_init(hostlist *l)
+{
+    l->arena   = NULL;
+    l->size    = 0;
+    l->mapped  = false;
+    l->names   = NULL;
+    l->n       = 0;
+    l->nalloc  = 0;
+    l->next    = 0;
+    l->ranging = false;
+}
+
+/*  Append a host name or range pattern to l.
+
+    Args:
+        l:      initialized hostlist.
+
+        name:   host name or pattern, which must remain valid
+                until hostlist_free.
+*/
+void hostlist_add(hostlist *l, char *name)
+{
+    hostrange r;
+
+    // fail on bad patterns now rather than part way through a run
+    if (hostrange_is(name)) {
+        hostrange_init(&r, name);
+        hostrange_free(&r);
+    }
+
+    if (l->n == l->nalloc) {
+        l->nalloc = l->nalloc > 0 ? 2*l->nalloc : 1024;
+        if ((l->names = realloc(l->names, sizeof(char*)*l->nalloc)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+    }
+
+    l->names[l->n++] = name;
+}
+
+/*  Fill hostlist_class.
+*/
+static void hostlist_class_init()
+{
+    hostlist_class[(unsigned char)'\0'] = hostlist_space;
+    hostlist_class[(unsigned char)'\n'] = hostlist_space;
+    hostlist_class[(unsigned char)'\r'] = hostlist_space;
+    hostlist_class[(unsigned char)'\t'] = hostlist_space;
+    hostlist_class[(unsigned char)' ']  = hostlist_space;
+    hostlist_class[(unsigned char)'#']  = hostlist_comment;
+}
+
+/*  Read all of fd into a buffer with one spare byte at the end.
+*/
+static void hostlist_read(hostlist *l, int fd)
+{
+    size_t size = 0;
+    ssize_t r;
+
+    l->arena = NULL;
+    l->size = 0;
+
+    while (true) {
+        if (size - l->size < 2) {
+            size = size > 0 ? 2*size : hostlist_block;
+            if ((l->arena = realloc(l->arena, size)) == NULL)
+                debug_fail_errno("Failed to allocate memory");
+        }
+
+        if ((r = read(fd, l->arena+l->size, size-l->size-1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            debug_fail_errno("Failed to read host list");
+        }
+
+        if (r == 0)
+            break;
+
+        l->size += r;
+    }
+}
+
+/*  Map a regular file privately so names can be terminated in place.
+    Returns false if the file cannot be mapped with a spare byte.
+*/
+static bool hostlist_map(hostlist *l, int fd)
+{
+    struct stat st;
+    void *arena;
+
+    if ((fstat(fd, &st) < 0) || !S_ISREG(st.st_mode) || (st.st_size == 0))
+        return false;
+
+    // the byte past the end must fall inside the last page
+    if ((st.st_size % sysconf(_SC_PAGESIZE)) == 0)
+        return false;
+
+    arena = mmap(NULL, st.st_size+1, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (arena == MAP_FAILED)
+        return false;
+
+    l->arena = arena;
+    l->size = st.st_size;
+    return true;
+}
+
+/*  Hash a null terminated host name.
+*/
+static uint64_t hostlist_hash(const char *name)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    for (; *name != '\0'; ++name)
+        h = (h ^ (unsigned char)*name) * 1099511628211ULL;
+
+    return h;
+}
+
+/*  Drop all but the first of any repeated names in l, keeping
+    order.  Range patterns are compared as written, the names
+    they expand to are not checked.
+
+    Args:
+        l:  loaded hostlist.
+*/
+void hostlist_dedup(hostlist *l)
+{
+    size_t mask, i, k, n = 0;
+    size_t *table;
+
+    for (mask = 1; mask < 2*l->n; mask <<= 1);
+
+    // slots hold name index plus one, zero when empty
+    if ((table = calloc(mask, sizeof(size_t))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+    --mask;
+
+    for (i = 0; i < l->n; ++i) {
+        for (k = hostlist_hash(l->names[i]) & mask; table[k] != 0; k = (k+1) & mask)
+            if (strcmp(l->names[table[k]-1], l->names[i]) == 0)
+                break;
+
+        if (table[k] != 0)
+            continue;
+
+        l->names[n] = l->names[i];
+        table[k] = ++n;
+    }
+
+    debug_print(2, "dropped %zu repeated hosts", l->n-n);
+
+    l->n = n;
+    free(table);
+}
+
+/*  Append every host name in fd to l.  Regular files are mapped
+    and anything else is read in large blocks.  Names are separated
+    by white space or null characters and a # starts a comment that
+    runs to the end of the line.  Only one file may be loaded.
+
+    Args:
+        l:      initialized hostlist.
+
+        fd:     file descriptor to read host names from.
+*/
+void hostlist_load(hostlist *l, int fd)
+{
+    size_t n = l->n;
+    char *c, *end;
+
+    if (hostlist_class[(unsigned char)' '] != hostlist_space)
+        hostlist_class_init();
+
+    if (!(l->mapped = hostlist_map(l, fd)))
+        hostlist_read(l, fd);
+
+    // spare byte terminates a name running to the end
+    end = l->arena+l->size;
+    *end = '\0';
+
+    for (c = l->arena; c < end; ) {
+        unsigned char k = hostlist_class[(unsigned char)*c];
+
+        if (k == hostlist_space)
+            ++c;
+
+        else if (k == hostlist_comment) {
+            if ((c = memchr(c, '\n', end-c)) == NULL)
+                break;
+        }
+
+        else {
+            char *name = c, *rest;
+
+            while (hostlist_class[(unsigned char)*++c] == hostlist_name);
+
+            // a comment may follow a name directly
+            rest = *c == '#' ? memchr(c+1, '\n', end-c-1) : c+1;
+
+            // terminated first, so only the name itself is checked
+            *c = '\0';
+            hostlist_add(l, name);
+
+            if ((c = rest) == NULL)
+                break;
+        }
+    }
+
+    debug_print(2, "loaded %zu hosts", l->n-n);
+}
+
+/*  Return the next host name in l, expanding range patterns
+    one name at a time as they are reached.
+
+    Args:
+        l:  loaded hostlist.
+
+    Returns:
+        host name, valid until the next call, or NULL once
+        every name has been returned.
+*/
+char *hostlist_next(hostlist *l)
+{
+    char *name;
+
+    while (true) {
+        if (l->ranging) {
+            if ((name = hostrange_next(&l->range)) != NULL)
+                return name;
+
+            hostrange_free(&l->range);
+            l->ranging = false;
+        }
+
+        if (l->next == l->n)
+            return NULL;
+
+        name = l->names[l->next++];
+        if (!hostrange_is(name))
+            return name;
+
+        hostrange_init(&l->range, name);
+        l->ranging = true;
+    }
+}
+
+/*  Count the host names in l, including every name matched
+    by range patterns, without expanding them.
+
+    Args:
+        l:  loaded hostlist.
+
+    Returns:
+        number of names, saturating at ULONG_MAX.
+*/
+unsigned long hostlist_count(const hostlist *l)
+{
+    unsigned long n = 0, m;
+    hostrange r;
+    size_t i;
+
+    for (i = 0; (i < l->n) && (n < ULONG_MAX); ++i) {
+        if (!hostrange_is(l->names[i]))
+            m = 1;
+        else {
+            hostrange_init(&r, l->names[i]);
+            m = hostrange_count(&r);
+            hostrange_free(&r);
+        }
+
+        n = m > ULONG_MAX - n ? ULONG_MAX : n + m;
+    }
+
+    return n;
+}
+
+/*  Start returning names from the beginning of l again.
+
+    Args:
+        l:  loaded hostlist.
+*/
+void hostlist_rewind(hostlist *l)
+{
+    if (l->ranging)
+        hostrange_free(&l->range);
+
+    l->ranging = false;
+    l->next = 0;
+}
+
+/*  Release the names and buffer held by l.
+
+    Args:
+        l:  hostlist to free.
+*/
+void hostlist_free(hostlist *l)
+{
+    if (l->mapped)
+        munmap(l->arena, l->size+1);
+    else
+        free(l->arena);
+
+    if (l->ranging)
+        hostrange_free(&l->range);
+
+    free(l->names);
+    hostlist_init(l);
+}
@@ -0,0 +1,129 @@
+/*
+ *  Load host lists in bulk.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef hostlist_h
+    #define hostlist_h
+
+    #include <stdbool.h>
+    #include <stddef.h>
+
+    #include "hostrange.h"
+
+    /* host names parsed in place from a single buffer */
+    typedef struct {
+        char    *arena;     // file contents, names null terminated in place
+        size_t   size;      // number of bytes in arena
+        bool     mapped;    // true if arena is a private mapping of the file
+        char   **names;     // host names in input order
+        size_t   n;         // number of names
+        size_t   nalloc;    // number of names allocated
+        size_t   next;      // index of next name returned by hostlist_next
+        hostrange range;    // pattern currently being expanded
+        bool     ranging;   // true while range is in use
+    } hostlist;
+
+    /*  Initialize an empty hostlist.
+
+        Args:
+            l:  hostlist to initialize.
+    */
+    void hostlist_init(hostlist *l);
+
+    /*  Append a host name or range pattern to l.
+
+        Args:
+            l:      initialized hostlist.
+
+            name:   host name or pattern, which must remain valid
+                    until hostlist_free.
+    */
+    void hostlist_add(hostlist *l, char *name);
+
+    /*  Append every host name in fd to l.  Regular files are mapped
+        and anything else is read in large blocks.  Names are separated
+        by white space or null characters and a # starts a comment that
+        runs to the end of the line.  Only one file may be loaded.
+
+        Args:
+            l:      initialized hostlist.
+
+            fd:     file descriptor to read host names from.
+    */
+    void hostlist_load(hostlist *l, int fd);
+
+    /*  Drop all but the first of any repeated names in l, keeping
+        order.  Range patterns are compared as written, the names
+        they expand to are not checked.
+
+        Args:
+            l:  loaded hostlist.
+    */
+    void hostlist_dedup(hostlist *l);
+
+    /*  Return the next host name in l, expanding range patterns
+        one name at a time as they are reached.
+
+        Args:
+            l:  loaded hostlist.
+
+        Returns:
+            host name, valid until the next call, or NULL once
+            every name has been returned.
+    */
+    char *hostlist_next(hostlist *l);
+
+    /*  Count the host names in l, including every name matched
+        by range patterns, without expanding them.
+
+        Args:
+            l:  loaded hostlist.
+
+        Returns:
+            number of names, saturating at ULONG_MAX.
+    */
+    unsigned long hostlist_count(const hostlist *l);
+
+    /*  Start returning names from the beginning of l again.
+
+        Args:
+            l:  loaded hostlist.
+    */
+    void hostlist_rewind(hostlist *l);
+
+    /*  Release the names and buffer held by l.
+
+        Args:
+            l:  hostlist to free.
+    */
+    void hostlist_free(hostlist *l);
+
+#endif
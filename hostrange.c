@@ -0,0 +1,311 @@
+/*
+ *  Lazily expand host range patterns.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hostrange.h"
+#include "debug.h"
+
+/*  Check whether name contains range syntax.
+
+    Args:
+        name:   host name or pattern.
+
+    Returns:
+        true if name should be expanded with hostrange.
+*/
+bool hostrange_is(const char *name)
+{
+    return strpbrk(name, "[{") != NULL;
+}
+
+/*  Append an item to a segment.
+*/
+static hostrange_item *hostrange_add(hostrange_seg *seg)
+{
+    seg->items = realloc(seg->items, sizeof(hostrange_item)*(seg->nitems+1));
+    if (seg->items == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    memset(&seg->items[seg->nitems], 0, sizeof(hostrange_item));
+    return &seg->items[seg->nitems++];
+}
+
+/*  Parse an unsigned number at *c, advancing past it.
+*/
+static unsigned long hostrange_num(const char *pattern, char **c, int *width)
+{
+    unsigned long n;
+    char *end;
+
+    if (!isdigit((unsigned char)**c))
+        debug_fail("Invalid host range %s", pattern);
+
+    errno = 0;
+    n = strtoul(*c, &end, 10);
+    if (errno != 0)
+        debug_fail("Invalid host range %s", pattern);
+
+    // leading zeros set the width
+    *width = ((**c == '0') && (end-*c > 1)) ? end-*c : 0;
+    *c = end;
+
+    return n;
+}
+
+/*  Parse the comma separated numbers and spans of a [] list,
+    which is null terminated in place.
+*/
+static void hostrange_parse_nums(const char *pattern, hostrange_seg *seg, char *c)
+{
+    int width;
+
+    do {
+        hostrange_item *item = hostrange_add(seg);
+
+        item->lo = item->hi = hostrange_num(pattern, &c, &item->width);
+
+        if (*c == '-') {
+            ++c;
+            item->hi = hostrange_num(pattern, &c, &width);
+        }
+
+        if ((item->hi < item->lo) || ((*c != ',') && (*c != '\0')))
+            debug_fail("Invalid host range %s", pattern);
+    }
+    while (*c++ == ',');
+}
+
+/*  Parse the comma separated text of a {} list,
+    which is null terminated in place.
+*/
+static void hostrange_parse_strs(hostrange_seg *seg, char *c)
+{
+    char *comma;
+
+    do {
+        hostrange_item *item = hostrange_add(seg);
+
+        if ((comma = strchr(c, ',')) == NULL)
+            comma = c+strlen(c);
+
+        item->str = c;
+        item->len = comma-c;
+        c = comma+1;
+    }
+    while (*comma == ',');
+}
+
+/*  Parse a pattern such as node[0001-4096] or rack{a,b,c}-[1,3-5].
+    Numbers with leading zeros keep their width.  Fails on invalid
+    patterns.
+
+    Args:
+        r:          hostrange to initialize.
+
+        pattern:    pattern to expand.
+*/
+void hostrange_init(hostrange *r, const char *pattern)
+{
+    size_t namelen = 1;
+    unsigned i, k;
+    char *c, *end;
+
+    if ((r->pattern = strdup(pattern)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    r->segs  = NULL;
+    r->nsegs = 0;
+    r->done  = false;
+
+    for (c = r->pattern; *c != '\0'; c = end) {
+        hostrange_seg *seg;
+
+        if ((r->segs = realloc(r->segs, sizeof(hostrange_seg)*(r->nsegs+1))) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+
+        seg = &r->segs[r->nsegs++];
+        seg->items  = NULL;
+        seg->nitems = seg->item = 0;
+        seg->num    = 0;
+
+        if ((*c == '[') || (*c == '{')) {
+            if ((end = strchr(c, *c == '[' ? ']' : '}')) == NULL)
+                debug_fail("Unterminated host range %s", pattern);
+            *end++ = '\0';
+
+            if (*c == '[')
+                hostrange_parse_nums(pattern, seg, c+1);
+            else
+                hostrange_parse_strs(seg, c+1);
+        }
+
+        else {
+            hostrange_item *item = hostrange_add(seg);
+
+            end = c + strcspn(c, "[{");
+            item->str = c;
+            item->len = end-c;
+        }
+    }
+
+    // room for the longest alternative of every segment
+    for (i = 0; i < r->nsegs; ++i) {
+        size_t longest = 0;
+
+        for (k = 0; k < r->segs[i].nitems; ++k) {
+            hostrange_item *item = &r->segs[i].items[k];
+            size_t len = item->str != NULL ? item->len :
+                         (size_t)snprintf(NULL, 0, "%0*lu", item->width, item->hi);
+
+            if (len > longest)
+                longest = len;
+        }
+
+        namelen += longest;
+    }
+
+    if ((r->name = malloc(namelen)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+}
+
+/*  Move to the next alternative of every segment like an odometer.
+*/
+static void hostrange_advance(hostrange *r)
+{
+    unsigned i = r->nsegs;
+
+    while (i-- > 0) {
+        hostrange_seg *seg = &r->segs[i];
+        hostrange_item *item = &seg->items[seg->item];
+
+        if ((item->str == NULL) && (item->lo+seg->num < item->hi)) {
+            ++seg->num;
+            return;
+        }
+
+        seg->num = 0;
+        if (++seg->item < seg->nitems)
+            return;
+
+        // carry into the segment to the left
+        seg->item = 0;
+    }
+
+    r->done = true;
+}
+
+/*  Return the next name matched by r.  The rightmost segment
+    varies fastest.
+
+    Args:
+        r:  initialized hostrange.
+
+    Returns:
+        host name, valid until the next call, or NULL once
+        every name has been returned.
+*/
+char *hostrange_next(hostrange *r)
+{
+    char *c = r->name;
+    unsigned i;
+
+    if (r->done)
+        return NULL;
+
+    for (i = 0; i < r->nsegs; ++i) {
+        hostrange_seg *seg = &r->segs[i];
+        hostrange_item *item = &seg->items[seg->item];
+
+        if (item->str != NULL) {
+            memcpy(c, item->str, item->len);
+            c += item->len;
+        }
+        else
+            c += sprintf(c, "%0*lu", item->width, item->lo+seg->num);
+    }
+    *c = '\0';
+
+    hostrange_advance(r);
+
+    return r->name;
+}
+
+/*  Count the names matched by r without expanding them.
+
+    Args:
+        r:  initialized hostrange.
+
+    Returns:
+        number of names, saturating at ULONG_MAX.
+*/
+unsigned long hostrange_count(const hostrange *r)
+{
+    unsigned long n = 1, nseg;
+    unsigned i, j;
+
+    for (i = 0; i < r->nsegs; ++i) {
+        nseg = 0;
+        for (j = 0; j < r->segs[i].nitems; ++j) {
+            const hostrange_item *item = &r->segs[i].items[j];
+            nseg += item->str != NULL ? 1 : item->hi - item->lo + 1;
+        }
+
+        if ((nseg > 0) && (n > ULONG_MAX/nseg))
+            return ULONG_MAX;
+        n *= nseg;
+    }
+
+    return n;
+}
+
+/*  Release everything held by r.
+
+    Args:
+        r:  hostrange to free.
+*/
+void hostrange_free(hostrange *r)
+{
+    unsigned i;
+
+    for (i = 0; i < r->nsegs; ++i)
+        free(r->segs[i].items);
+
+    free(r->segs);
+    free(r->name);
+    free(r->pattern);
+}
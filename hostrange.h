@@ -0,0 +1,115 @@
+/*
+ *  Lazily expand host range patterns.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef hostrange_h
+    #define hostrange_h
+
+    #include <stdbool.h>
+    #include <stddef.h>
+
+    /* one alternative of a segment, either text or a numeric span */
+    typedef struct {
+        const char    *str;     // text, not null terminated, NULL if numeric
+        size_t         len;     // length of str
+        unsigned long  lo;      // first number of span
+        unsigned long  hi;      // last number of span
+        int            width;   // zero padded width of numbers
+    } hostrange_item;
+
+    /* literal text, a [1-3,7] list of numbers or a {a,b} list of text */
+    typedef struct {
+        hostrange_item *items;  // alternatives of this segment
+        unsigned        nitems; // number of items
+        unsigned        item;   // current item
+        unsigned long   num;    // current number within a numeric item
+    } hostrange_seg;
+
+    /* generator for the names matched by a pattern */
+    typedef struct {
+        char          *pattern; // copy of pattern, items point into it
+        hostrange_seg *segs;    // segments in order
+        unsigned       nsegs;   // number of segments
+        char          *name;    // buffer for the current name
+        bool           done;    // true once every name was returned
+    } hostrange;
+
+    /*  Check whether name contains range syntax.
+
+        Args:
+            name:   host name or pattern.
+
+        Returns:
+            true if name should be expanded with hostrange.
+    */
+    bool hostrange_is(const char *name);
+
+    /*  Parse a pattern such as node[0001-4096] or rack{a,b,c}-[1,3-5].
+        Numbers with leading zeros keep their width.  Fails on invalid
+        patterns.
+
+        Args:
+            r:          hostrange to initialize.
+
+            pattern:    pattern to expand.
+    */
+    void hostrange_init(hostrange *r, const char *pattern);
+
+    /*  Return the next name matched by r.  The rightmost segment
+        varies fastest.
+
+        Args:
+            r:  initialized hostrange.
+
+        Returns:
+            host name, valid until the next call, or NULL once
+            every name has been returned.
+    */
+    char *hostrange_next(hostrange *r);
+
+    /*  Count the names matched by r without expanding them.
+
+        Args:
+            r:  initialized hostrange.
+
+        Returns:
+            number of names, saturating at ULONG_MAX.
+    */
+    unsigned long hostrange_count(const hostrange *r);
+
+    /*  Release everything held by r.
+
+        Args:
+            r:  hostrange to free.
+    */
+    void hostrange_free(hostrange *r);
+
+#endif
@@ -0,0 +1,463 @@
+/*
+ *  Growable buffers for captured command output.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "outbuf.h"
+#include "debug.h"
+
+#define outbuf_chunk 4096       // minimum free space before each read
+#define outbuf_copy  65536      // size of copies into spill files
+#define outbuf_relay (1UL << 20)// size of copies out of spill files
+
+/* 64 bit FNV-1a */
+#define outbuf_fnv_basis 0xcbf29ce484222325ULL
+#define outbuf_fnv_prime 0x100000001b3ULL
+
+static size_t outbuf_host_limit  = outbuf_host_default;
+static size_t outbuf_total_limit = outbuf_total_default;
+static size_t outbuf_total = 0;     // bytes allocated by all buffers
+static bool   outbuf_hashing = false; // true to hash everything captured
+
+/*  Set the thresholds past which buffers spill to disk.
+
+    Args:
+        host:   largest number of bytes held in memory by
+                a single buffer.
+
+        total:  largest number of bytes held in memory by
+                all buffers together.
+*/
+void outbuf_limit(size_t host, size_t total)
+{
+    outbuf_host_limit  = host;
+    outbuf_total_limit = total;
+}
+
+/*  Hash output as it is captured, so buffers can be compared
+    by hash without reading them back.  Spilled buffers are then
+    filled with read and write instead of splice.
+
+    Args:
+        on:     true to hash everything captured from now on.
+*/
+void outbuf_hash(bool on)
+{
+    outbuf_hashing = on;
+}
+
+/*  Initialize an empty output buffer.
+
+    Args:
+        b:  outbuf to initialize.
+*/
+void outbuf_init(outbuf *b)
+{
+    b->data = NULL;
+    b->len  = 0;
+    b->size = 0;
+    b->fd   = -1;
+    b->hash = outbuf_fnv_basis;
+}
+
+/*  Add len bytes of data to the hash of b if hashing.
+*/
+static void outbuf_mix(outbuf *b, const char *data, size_t len)
+{
+    const unsigned char *c = (const unsigned char*)data;
+    uint64_t h = b->hash;
+
+    if (!outbuf_hashing)
+        return;
+
+    for (; len > 0; --len, ++c)
+        h = (h ^ *c)*outbuf_fnv_prime;
+
+    b->hash = h;
+}
+
+/*  Write all len bytes of data to fd.
+
+    Returns:
+        0 on success or -1 on error with errno set.
+*/
+static int outbuf_put(int fd, const char *data, size_t len)
+{
+    ssize_t w;
+
+    while (len > 0) {
+        if ((w = write(fd, data, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        data += w;
+        len  -= w;
+    }
+
+    return 0;
+}
+
+/*  Write all len bytes of data to fd, failing on error.
+*/
+static void outbuf_write_all(int fd, const char *data, size_t len)
+{
+    if (outbuf_put(fd, data, len) < 0)
+        debug_fail_errno("Failed to write spill file");
+}
+
+/*  Move the contents of b into an unlinked file in $TMPDIR
+    and release its memory.
+*/
+static void outbuf_spill(outbuf *b)
+{
+    const char *dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+    if ((b->fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) < 0) {
+        // filesystem may not support O_TMPFILE
+        char *name;
+        if (asprintf(&name, "%s/sshall-XXXXXX", dir) < 0)
+            debug_fail_errno("Failed to allocate memory");
+
+        if ((b->fd = mkostemp(name, O_CLOEXEC)) < 0)
+            debug_fail_errno("Failed to create spill file %s", name);
+
+        unlink(name);
+        free(name);
+    }
+
+    debug_print(3, "spilling %zu bytes to disk", b->len);
+
+    outbuf_write_all(b->fd, b->data, b->len);
+
+    outbuf_total -= b->size;
+    free(b->data);
+    b->data = NULL;
+    b->size = 0;
+}
+
+/*  Make room for at least n more bytes in memory, spilling b to
+    disk instead if that would cross the per-buffer or total limit.
+*/
+static void outbuf_reserve(outbuf *b, size_t n)
+{
+    size_t size = b->size < outbuf_chunk ? outbuf_chunk : b->size;
+    char *data;
+
+    if ((b->fd > -1) || (b->size - b->len >= n))
+        return;
+
+    // double the buffer so appends stay amortized constant
+    while (size - b->len < n)
+        size *= 2;
+
+    if (size > outbuf_host_limit)
+        size = b->len+n > outbuf_host_limit ? b->len+n : outbuf_host_limit;
+
+    if ((b->len+n > outbuf_host_limit) ||
+        (outbuf_total-b->size+size > outbuf_total_limit)) {
+        outbuf_spill(b);
+        return;
+    }
+
+    if ((data = realloc(b->data, size)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    outbuf_total += size - b->size;
+    b->data = data;
+    b->size = size;
+}
+
+/*  Append len bytes from data to b, growing the buffer as needed.
+
+    Args:
+        b:      outbuf to append to.
+
+        data:   bytes to append.
+
+        len:    number of bytes in data.
+*/
+void outbuf_append(outbuf *b, const char *data, size_t len)
+{
+    outbuf_reserve(b, len);
+
+    if (b->fd > -1)
+        outbuf_write_all(b->fd, data, len);
+    else
+        memcpy(b->data+b->len, data, len);
+
+    outbuf_mix(b, data, len);
+    b->len += len;
+}
+
+/*  Perform a single read from fd and append the result
+    to b, growing the buffer as needed.
+
+    Args:
+        b:  outbuf to append to.
+
+        fd: file descriptor to read from.
+
+    Returns:
+        number of bytes read, 0 on end of file or -1
+        on error with errno set.
+*/
+ssize_t outbuf_read(outbuf *b, int fd)
+{
+    size_t left = b->len < outbuf_host_limit ? outbuf_host_limit - b->len : 0;
+    ssize_t r;
+
+    // read no more than fits under the limit, so only output
+    // actually past it spills
+    if ((b->fd < 0) && (left > 0))
+        outbuf_reserve(b, left < outbuf_chunk ? left : outbuf_chunk);
+
+    if ((b->fd < 0) && (left > 0)) {
+        if ((r = read(fd, b->data+b->len,
+                      b->size-b->len < left ? b->size-b->len : left)) > 0)
+            outbuf_mix(b, b->data+b->len, r);
+    }
+
+    // full, spilling once there is more
+    else if (b->fd < 0) {
+        char buff[outbuf_copy];
+
+        if ((r = read(fd, buff, sizeof(buff))) > 0)
+            outbuf_append(b, buff, r);
+        return r;
+    }
+
+    // move pipe pages straight into the spill file, unless they must be hashed
+    else if (outbuf_hashing ||
+             (((r = splice(fd, NULL, b->fd, NULL, outbuf_copy, SPLICE_F_MOVE)) < 0) &&
+              (errno == EINVAL))) {
+        char buff[outbuf_copy];
+
+        if ((r = read(fd, buff, sizeof(buff))) > 0) {
+            outbuf_write_all(b->fd, buff, r);
+            outbuf_mix(b, buff, r);
+        }
+    }
+
+    if (r > 0)
+        b->len += r;
+
+    return r;
+}
+
+/*  Write all n vectors in iov to fd, retrying short writes.
+    The vectors are updated as they are written.
+
+    Args:
+        fd:     file descriptor to write to.
+
+        iov:    vectors to write.
+
+        n:      number of vectors in iov.
+
+    Returns:
+        0 on success or -1 on error with errno set.
+*/
+int outbuf_putv(int fd, struct iovec *iov, int n)
+{
+    ssize_t w;
+
+    while (n > 0) {
+        if ((w = writev(fd, iov, n)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        // skip over everything that was written
+        for (; (n > 0) && ((size_t)w >= iov->iov_len); --n, ++iov)
+            w -= iov->iov_len;
+
+        if (n > 0) {
+            iov->iov_base = (char*)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+
+    return 0;
+}
+
+/*  Copy len bytes from the start of file in to fd, in the kernel
+    if possible, otherwise through a large buffer.
+
+    Returns:
+        0 on success or -1 on error with errno set.
+*/
+static int outbuf_relay_file(int in, size_t len, int fd)
+{
+    enum { use_sendfile, use_splice, use_copy_range, use_buffer } how = use_sendfile;
+    struct stat st;
+    loff_t off = 0, end = (loff_t)len;
+    ssize_t r;
+    char *buff;
+
+    while ((off < end) && (how != use_buffer)) {
+        if (how == use_sendfile)
+            r = sendfile(fd, in, &off, len-off);
+        else if (how == use_splice)
+            r = splice(in, &off, fd, NULL, len-off, SPLICE_F_MOVE);
+        else
+            r = copy_file_range(in, &off, fd, NULL, len-off, 0);
+
+        if (r > 0)
+            continue;
+
+        // spill file was truncated underneath us
+        if (r == 0) {
+            errno = EIO;
+            return -1;
+        }
+
+        if (errno == EINTR)
+            continue;
+
+        if ((errno != EINVAL) && (errno != ENOSYS) && (errno != EXDEV) &&
+            (errno != EBADF)  && (errno != EOPNOTSUPP))
+            return -1;
+
+        // sendfile refuses some outputs, eg, O_APPEND files, so try splice
+        // for pipes and copy_file_range for files before using a buffer
+        if ((how != use_sendfile) || (fstat(fd, &st) < 0))
+            how = use_buffer;
+        else if (S_ISFIFO(st.st_mode))
+            how = use_splice;
+        else if (S_ISREG(st.st_mode))
+            how = use_copy_range;
+        else
+            how = use_buffer;
+    }
+
+    if (off == end)
+        return 0;
+
+    debug_print(3, "copying spill file through user space");
+
+    if ((buff = malloc(outbuf_relay)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    while (off < end) {
+        if ((r = pread(in, buff, outbuf_relay, off)) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        // spill file was truncated underneath us
+        if (r == 0) {
+            errno = EIO;
+            break;
+        }
+
+        if (outbuf_put(fd, buff, r) < 0)
+            break;
+
+        off += r;
+    }
+
+    free(buff);
+    return off == end ? 0 : -1;
+}
+
+/*  Write head, the entire contents of b and then tail to fd.
+    Buffers held in memory are written with a single writev,
+    spilled buffers are copied in the kernel with sendfile,
+    splice or copy_file_range when fd allows it.
+
+    Args:
+        b:      outbuf to write.
+
+        fd:     file descriptor to write to.
+
+        head:   bytes to write before b, may be NULL.
+
+        tail:   bytes to write after b, may be NULL.
+
+    Returns:
+        0 on success or -1 on error with errno set.
+*/
+int outbuf_write(const outbuf *b, int fd,
+                 const struct iovec *head, const struct iovec *tail)
+{
+    struct iovec iov[3];
+    int n = 0;
+
+    if (head != NULL)
+        iov[n++] = *head;
+
+    if (b->fd < 0) {
+        iov[n].iov_base = b->data;
+        iov[n++].iov_len = b->len;
+    }
+
+    else if ((outbuf_putv(fd, iov, n) < 0) ||
+             (outbuf_relay_file(b->fd, b->len, fd) < 0))
+        return -1;
+
+    else
+        n = 0;
+
+    if (tail != NULL)
+        iov[n++] = *tail;
+
+    return outbuf_putv(fd, iov, n);
+}
+
+/*  Release any memory or file held by b and leave it empty.
+
+    Args:
+        b:  outbuf to free.
+*/
+void outbuf_free(outbuf *b)
+{
+    if (b->fd > -1)
+        close(b->fd);
+
+    outbuf_total -= b->size;
+    free(b->data);
+    outbuf_init(b);
+}
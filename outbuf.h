@@ -0,0 +1,150 @@
+/*
+ *  Growable buffers for captured command output.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef outbuf_h
+    #define outbuf_h
+
+    #include <stdbool.h>
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <sys/types.h>
+    #include <sys/uio.h>
+
+    /* default byte thresholds past which buffers spill to disk */
+    #define outbuf_host_default  (1UL << 20)     // per buffer
+    #define outbuf_total_default (64UL << 20)    // across all buffers
+
+    /* captured output of a single command, held in memory until
+       it grows past a limit and then moved to an unlinked file */
+    typedef struct {
+        char   *data;   // buffered bytes while in memory
+        size_t  len;    // number of bytes captured
+        size_t  size;   // number of bytes allocated
+        int     fd;     // spill file, -1 while in memory
+        uint64_t hash;  // hash of the bytes captured, if hashing
+    } outbuf;
+
+    /*  Set the thresholds past which buffers spill to disk.
+
+        Args:
+            host:   largest number of bytes held in memory by
+                    a single buffer.
+
+            total:  largest number of bytes held in memory by
+                    all buffers together.
+    */
+    void outbuf_limit(size_t host, size_t total);
+
+    /*  Hash output as it is captured, so buffers can be compared
+        by hash without reading them back.  Spilled buffers are then
+        filled with read and write instead of splice.
+
+        Args:
+            on:     true to hash everything captured from now on.
+    */
+    void outbuf_hash(bool on);
+
+    /*  Initialize an empty output buffer.
+
+        Args:
+            b:  outbuf to initialize.
+    */
+    void outbuf_init(outbuf *b);
+
+    /*  Append len bytes from data to b, growing the buffer as needed.
+
+        Args:
+            b:      outbuf to append to.
+
+            data:   bytes to append.
+
+            len:    number of bytes in data.
+    */
+    void outbuf_append(outbuf *b, const char *data, size_t len);
+
+    /*  Perform a single read from fd and append the result
+        to b, growing the buffer as needed.
+
+        Args:
+            b:  outbuf to append to.
+
+            fd: file descriptor to read from.
+
+        Returns:
+            number of bytes read, 0 on end of file or -1
+            on error with errno set.
+    */
+    ssize_t outbuf_read(outbuf *b, int fd);
+
+    /*  Write all n vectors in iov to fd, retrying short writes.
+        The vectors are updated as they are written.
+
+        Args:
+            fd:     file descriptor to write to.
+
+            iov:    vectors to write.
+
+            n:      number of vectors in iov.
+
+        Returns:
+            0 on success or -1 on error with errno set.
+    */
+    int outbuf_putv(int fd, struct iovec *iov, int n);
+
+    /*  Write head, the entire contents of b and then tail to fd.
+        Buffers held in memory are written with a single writev,
+        spilled buffers are copied in the kernel with sendfile,
+        splice or copy_file_range when fd allows it.
+
+        Args:
+            b:      outbuf to write.
+
+            fd:     file descriptor to write to.
+
+            head:   bytes to write before b, may be NULL.
+
+            tail:   bytes to write after b, may be NULL.
+
+        Returns:
+            0 on success or -1 on error with errno set.
+    */
+    int outbuf_write(const outbuf *b, int fd,
+                     const struct iovec *head, const struct iovec *tail);
+
+    /*  Release any memory or file held by b and leave it empty.
+
+        Args:
+            b:  outbuf to free.
+    */
+    void outbuf_free(outbuf *b);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ *  Standard input read once and given to every command.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "payload.h"
+#include "debug.h"
+
+#define payload_copy (1UL << 20) // size of copies into the spool
+
+static int payload_fd = -1; // file holding the payload, -1 if none
+
+/*  Directory the payload is spooled to.
+*/
+static const char *payload_dir()
+{
+    return getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+}
+
+/*  Fail on an error writing the spool, naming the directory
+    when it is out of space, as nothing is sent of a payload that
+    does not fit.
+*/
+static void payload_fail_write()
+{
+    if ((errno == ENOSPC) || (errno == EDQUOT))
+        debug_fail("Not enough space in %s for the payload, set TMPDIR to a "
+                   "larger directory or redirect a file to standard input", payload_dir());
+
+    debug_fail_errno("Failed to write payload file");
+}
+
+/*  Create an unlinked file in $TMPDIR to hold the payload.
+*/
+static int payload_spool()
+{
+    const char *dir = payload_dir();
+    int fd;
+
+    if ((fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) < 0) {
+        // filesystem may not support O_TMPFILE
+        char *name;
+        if (asprintf(&name, "%s/sshall-XXXXXX", dir) < 0)
+            debug_fail_errno("Failed to allocate memory");
+
+        if ((fd = mkostemp(name, O_CLOEXEC)) < 0)
+            debug_fail_errno("Failed to create payload file %s", name);
+
+        unlink(name);
+        free(name);
+    }
+
+    return fd;
+}
+
+/*  Copy everything from in to out with read and write.
+*/
+static void payload_copy_all(int in, int out)
+{
+    char *buff;
+    ssize_t r;
+
+    if ((buff = malloc(payload_copy)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    while ((r = read(in, buff, payload_copy)) != 0) {
+        char *p = buff;
+
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            debug_fail_errno("Failed to read payload");
+        }
+
+        while (r > 0) {
+            ssize_t w = write(out, p, r);
+            if (w < 0) {
+                if (errno == EINTR)
+                    continue;
+                payload_fail_write();
+            }
+            p += w;
+            r -= w;
+        }
+    }
+
+    free(buff);
+}
+
+/*  Keep the contents of in for every command to read.  A regular
+    file is used in place, anything else is copied once, with
+    splice when possible, to an unlinked file in $TMPDIR so that
+    memory use does not depend on its size.  Fails on error,
+    naming $TMPDIR if it has no room for the payload.
+
+    Args:
+        in:     descriptor to read, eg, standard input.
+*/
+void payload_init(int in)
+{
+    struct stat st;
+    ssize_t r;
+
+    if (fstat(in, &st) < 0)
+        debug_fail_errno("Failed to stat payload");
+
+    if (S_ISREG(st.st_mode)) {
+        if ((payload_fd = fcntl(in, F_DUPFD_CLOEXEC, 0)) < 0)
+            debug_fail_errno("Failed to duplicate payload");
+
+        debug_print(2, "payload of %lld bytes used in place", (long long)st.st_size);
+        return;
+    }
+
+    payload_fd = payload_spool();
+
+    // a pipe moves into the file without passing through our memory
+    while ((r = splice(in, NULL, payload_fd, NULL, payload_copy, SPLICE_F_MOVE)) != 0) {
+        if (r > 0)
+            continue;
+
+        if (errno == EINTR)
+            continue;
+
+        if ((errno == ENOSPC) || (errno == EDQUOT))
+            payload_fail_write();
+
+        if (errno != EINVAL)
+            debug_fail_errno("Failed to read payload");
+
+        // not a pipe or not supported by the filesystem
+        payload_copy_all(in, payload_fd);
+        break;
+    }
+
+    debug_print(2, "payload of %lld bytes spooled", (long long)lseek(payload_fd, 0, SEEK_END));
+}
+
+/*  Return a new descriptor for the payload positioned at its
+    start, with an offset of its own so that commands read at
+    their own pace.  Matches sched_opts.input.
+
+    Args:
+        index:  position of the host, unused.
+*/
+int payload_input(unsigned index)
+{
+    char path[64];
+    int fd;
+
+    (void)index;
+
+    // a duplicate would share its offset with every other command
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", payload_fd);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to open payload");
+
+    return fd;
+}
+
+/*  Release the payload, if any.
+*/
+void payload_free()
+{
+    if (payload_fd > -1)
+        close(payload_fd);
+
+    payload_fd = -1;
+}
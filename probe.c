@@ -0,0 +1,591 @@
+/*
+ *  Reachability of hosts checked before a run, with a cache of dead hosts.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "probe.h"
+#include "adapt.h"
+#include "debug.h"
+
+#define probe_chunk   1024  // host names resolved at once
+#define probe_nevents 256   // maximum events per epoll_wait
+#define probe_portmax 64    // longest port in the cache
+
+/* 64 bit FNV-1a */
+#define probe_fnv_basis 0xcbf29ce484222325ULL
+#define probe_fnv_prime 0x100000001b3ULL
+
+/* a dead host */
+typedef struct {
+    char   *host;   // host as returned by next
+    time_t  when;   // when it was found dead
+} probe_entry;
+
+/* connection to one host in flight */
+typedef struct {
+    char            *host;  // host as returned by next, NULL if slot is free
+    struct addrinfo *ai;    // addresses of host
+    struct addrinfo *addr;  // address being tried
+    int              fd;    // socket connecting to addr
+    struct timespec  expire;// when to give up on host
+} probe_conn;
+
+/* host whose name resolved, waiting to be probed */
+typedef struct {
+    char            *host;  // host as returned by next
+    struct addrinfo *ai;    // addresses of host
+} probe_name;
+
+/* names being resolved together */
+typedef struct {
+    struct gaicb  cb[probe_chunk];
+    struct gaicb *req[probe_chunk];
+    char         *host[probe_chunk];
+    unsigned      n;        // names in this chunk
+} probe_batch;
+
+static probe_entry   *probe_table = NULL;   // dead hosts, open addressed
+static unsigned long  probe_tsize = 0;      // slots in probe_table, a power of two
+static unsigned long  probe_n = 0;          // dead hosts in probe_table
+static unsigned long  probe_nrun = 0;       // hosts of this run found dead, cached or probed
+static char         **probe_kept = NULL;    // cache lines for other ports
+static unsigned       probe_nkept = 0;      // number of lines in probe_kept
+
+/*  Slot holding host or the free slot where it belongs.
+*/
+static unsigned long probe_slot(const char *host)
+{
+    uint64_t h = probe_fnv_basis;
+    const char *p;
+    unsigned long slot;
+
+    for (p = host; *p != '\0'; ++p)
+        h = (h ^ (unsigned char)*p)*probe_fnv_prime;
+
+    for (slot = h & (probe_tsize-1); probe_table[slot].host != NULL;
+         slot = (slot+1) & (probe_tsize-1))
+        if (strcmp(probe_table[slot].host, host) == 0)
+            break;
+
+    return slot;
+}
+
+/*  Remember host as dead since when, taking ownership of host.
+*/
+static void probe_add(char *host, time_t when)
+{
+    unsigned long slot, i;
+
+    // double the table once it is half full
+    if (2*(probe_n+1) > probe_tsize) {
+        probe_entry *old = probe_table;
+        unsigned long osize = probe_tsize;
+
+        probe_tsize = probe_tsize > 0 ? 2*probe_tsize : 64;
+        if ((probe_table = calloc(probe_tsize, sizeof(probe_entry))) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+
+        for (i = 0; i < osize; ++i)
+            if (old[i].host != NULL)
+                probe_table[probe_slot(old[i].host)] = old[i];
+        free(old);
+    }
+
+    slot = probe_slot(host);
+    if (probe_table[slot].host != NULL) {
+        free(host);
+        return;
+    }
+
+    probe_table[slot].host = host;
+    probe_table[slot].when = when;
+    ++probe_n;
+}
+
+/*  Default cache file, creating ~/.cache if needed.
+*/
+static char *probe_cache_default()
+{
+    const char *base = getenv("XDG_CACHE_HOME");
+    char *path = NULL;
+    int r = 0;
+
+    if (base != NULL)
+        r = asprintf(&path, "%s/sshall-dead", base);
+
+    else if ((base = getenv("HOME")) != NULL) {
+        if ((r = asprintf(&path, "%s/.cache", base)) >= 0) {
+            if ((mkdir(path, 0700) < 0) && (errno != EEXIST))
+                debug_warn_errno("Failed to create %s", path);
+            free(path);
+            r = asprintf(&path, "%s/.cache/sshall-dead", base);
+        }
+    }
+
+    if (r < 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    return path;
+}
+
+/*  Read the cache, remembering its dead hosts for port and
+    keeping those for other ports to write back, both only if
+    they were found less than ttl seconds ago.
+*/
+static void probe_load(const char *path, const char *port, long ttl, time_t now)
+{
+    char *line = NULL, p[probe_portmax];
+    size_t size = 0;
+    ssize_t len;
+    long when;
+    int off;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL) {
+        if (errno != ENOENT)
+            debug_warn_errno("Failed to open %s", path);
+        return;
+    }
+
+    while ((len = getline(&line, &size, f)) > 0) {
+        char *host;
+
+        if (line[len-1] == '\n')
+            line[--len] = '\0';
+
+        if ((sscanf(line, "%ld %63s %n", &when, p, &off) < 2) || (line[off] == '\0') ||
+                (when + ttl <= now))
+            continue;
+
+        if (strcmp(p, port) != 0) {
+            if ((probe_kept = realloc(probe_kept, sizeof(char*)*(probe_nkept+1))) == NULL)
+                debug_fail_errno("Failed to allocate memory");
+            if ((probe_kept[probe_nkept++] = strdup(line)) == NULL)
+                debug_fail_errno("Failed to allocate memory");
+            continue;
+        }
+
+        if ((host = strdup(line+off)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        probe_add(host, when);
+    }
+
+    free(line);
+    fclose(f);
+}
+
+/*  Write the dead hosts back to the cache, replacing it at once.
+*/
+static void probe_save(const char *path, const char *port)
+{
+    unsigned long i;
+    char *tmp;
+    FILE *f;
+    int fd;
+
+    if (asprintf(&tmp, "%s.XXXXXX", path) < 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    if (((fd = mkostemp(tmp, O_CLOEXEC)) < 0) || ((f = fdopen(fd, "w")) == NULL)) {
+        debug_warn_errno("Failed to create %s", tmp);
+        if (fd > -1) {
+            close(fd);
+            unlink(tmp);
+        }
+        free(tmp);
+        return;
+    }
+
+    for (i = 0; i < probe_nkept; ++i)
+        fprintf(f, "%s\n", probe_kept[i]);
+
+    for (i = 0; i < probe_tsize; ++i)
+        if (probe_table[i].host != NULL)
+            fprintf(f, "%ld %s %s\n", (long)probe_table[i].when, port, probe_table[i].host);
+
+    if ((fclose(f) != 0) || (rename(tmp, path) < 0)) {
+        debug_warn_errno("Failed to write %s", path);
+        unlink(tmp);
+    }
+
+    free(tmp);
+}
+
+/*  Resolve the hosts returned by next that are not already
+    known to be dead, a chunk of names in parallel at a time, and
+    return those that resolved in a new array of *n.  Hosts known
+    to be dead are counted in *ncached.  Names are
+    resolved before any connection starts, so no time spent
+    resolving counts against the timeout of a connection.
+*/
+static probe_name *probe_resolve(char *(*next)(), const char *port, unsigned long *n,
+                                 unsigned long *ncached)
+{
+    static const struct addrinfo hints = {.ai_socktype = SOCK_STREAM, .ai_flags = AI_ADDRCONFIG};
+    unsigned long size = 0;
+    probe_name *names = NULL;
+    probe_batch *b;
+    bool more = true;
+    char *host, *at;
+    unsigned i;
+    int err;
+
+    if ((b = malloc(sizeof(probe_batch))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    for (*n = *ncached = 0; more; ) {
+        for (b->n = 0; b->n < probe_chunk; ) {
+            if ((host = next()) == NULL) {
+                more = false;
+                break;
+            }
+
+            if (probe_dead(host)) {
+                ++*ncached;
+                continue;
+            }
+
+            if ((b->host[b->n] = strdup(host)) == NULL)
+                debug_fail_errno("Failed to allocate memory");
+
+            // user@host reaches host
+            at = strrchr(b->host[b->n], '@');
+
+            memset(&b->cb[b->n], 0, sizeof(struct gaicb));
+            b->cb[b->n].ar_name    = at != NULL ? at+1 : b->host[b->n];
+            b->cb[b->n].ar_service = port;
+            b->cb[b->n].ar_request = &hints;
+            b->req[b->n] = &b->cb[b->n];
+            ++b->n;
+        }
+
+        if (b->n == 0)
+            break;
+
+        if (getaddrinfo_a(GAI_WAIT, b->req, b->n, NULL) != 0)
+            for (i = 0; i < b->n; ++i)
+                if (gai_error(b->req[i]) == EAI_INPROGRESS)
+                    gai_cancel(b->req[i]);
+
+        for (i = 0; i < b->n; ++i) {
+            if ((err = gai_error(b->req[i])) != 0) {
+                debug_print(2, "%s not resolved, %s", b->host[i], gai_strerror(err));
+                free(b->host[i]);
+                continue;
+            }
+
+            if (*n == size) {
+                size = size > 0 ? 2*size : probe_chunk;
+                if ((names = realloc(names, sizeof(probe_name)*size)) == NULL)
+                    debug_fail_errno("Failed to allocate memory");
+            }
+
+            names[*n].host = b->host[i];
+            names[(*n)++].ai = b->cb[i].ar_result;
+        }
+    }
+
+    free(b);
+    return names;
+}
+
+/*  Try the addresses of c from c->addr on until one is being
+    connected to, returning 1 if connected at once, 0 if in
+    flight and -1 with errno set if none are left.
+*/
+static int probe_connect(probe_conn *c, int epfd, unsigned slot)
+{
+    struct epoll_event ev = {.events = EPOLLOUT, .data.u32 = slot};
+    int err = EHOSTUNREACH;
+
+    for (; c->addr != NULL; c->addr = c->addr->ai_next) {
+        if ((c->fd = socket(c->addr->ai_family, c->addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                            c->addr->ai_protocol)) < 0) {
+            err = errno;
+            continue;
+        }
+
+        if (connect(c->fd, c->addr->ai_addr, c->addr->ai_addrlen) == 0) {
+            close(c->fd);
+            c->fd = -1;
+            return 1;
+        }
+
+        if (errno == EINPROGRESS) {
+            if (epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev) < 0)
+                debug_fail_errno("Failed to add socket to epoll");
+            return 0;
+        }
+
+        err = errno;
+        close(c->fd);
+        c->fd = -1;
+    }
+
+    errno = err;
+    return -1;
+}
+
+/*  Free the slot of c, remembering its host as dead if it is.
+*/
+static void probe_end(probe_conn *c, bool dead, const char *why, time_t now)
+{
+    if (c->fd > -1)
+        close(c->fd);
+
+    if (dead) {
+        debug_print(1, "%s unreachable, %s", c->host, why);
+        probe_add(c->host, now);
+        ++probe_nrun;
+    }
+    else
+        free(c->host);
+
+    freeaddrinfo(c->ai);
+    c->host = NULL;
+    c->ai = c->addr = NULL;
+    c->fd = -1;
+}
+
+/*  Connect to port on every host returned by next, all at once
+    with as many connections in flight as open file limits allow,
+    and remember the hosts that refuse, are unreachable or do not
+    answer within timeout.  Hosts that cannot be resolved are
+    left for the transport, eg, ssh may know them by another name.
+
+    Dead hosts are kept in cache with the time they were found
+    and are not probed again for ttl seconds.
+
+    Args:
+        next:       returns the next host or NULL when done.
+
+        port:       port to connect to.
+
+        timeout:    longest to wait for each connection.
+
+        cache:      file of dead hosts, NULL for the default
+                    $XDG_CACHE_HOME/sshall-dead or else
+                    ~/.cache/sshall-dead.
+
+        ttl:        seconds a dead host stays in the cache,
+                    0 for no cache.
+*/
+void probe_run(char *(*next)(), const char *port, struct timespec timeout,
+               const char *cache, long ttl)
+{
+    struct epoll_event ev[probe_nevents];
+    unsigned max = adapt_ceiling(1), nflight = 0, slot;
+    unsigned long nnames, taken = 0, ncached;
+    probe_name *names;
+    probe_conn *conns;
+    char *path = NULL;
+    time_t now = time(NULL);
+    int epfd, n, i;
+
+    if (ttl > 0) {
+        path = cache != NULL ? strdup(cache) : probe_cache_default();
+        if (path == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        probe_load(path, port, ttl, now);
+    }
+
+    names = probe_resolve(next, port, &nnames, &ncached);
+    probe_nrun = ncached;
+
+    if ((conns = calloc(max, sizeof(probe_conn))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+    for (slot = 0; slot < max; ++slot)
+        conns[slot].fd = -1;
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to create epoll instance");
+
+    debug_print(2, "probing %lu hosts on port %s with up to %u connections", nnames, port, max);
+
+    while (true) {
+        struct timespec ts;
+        double wait = -1.0, ms;
+
+        // start connections while slots and names are left
+        for (slot = 0; (nflight < max) && (taken < nnames); ++taken) {
+            probe_conn *c;
+            int r;
+
+            for (; conns[slot].host != NULL; ++slot);
+            c = &conns[slot];
+            c->host = names[taken].host;
+            c->ai = c->addr = names[taken].ai;
+
+            clock_gettime(CLOCK_MONOTONIC, &c->expire);
+            c->expire.tv_sec  += timeout.tv_sec;
+            c->expire.tv_nsec += timeout.tv_nsec;
+            if (c->expire.tv_nsec >= 1000000000L) {
+                c->expire.tv_nsec -= 1000000000L;
+                ++c->expire.tv_sec;
+            }
+
+            if ((r = probe_connect(c, epfd, slot)) == 0)
+                ++nflight;
+            else
+                probe_end(c, r < 0, strerror(errno), now);
+        }
+
+        if (nflight == 0)
+            break;
+
+        // wait no longer than the first connection due to expire
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        for (slot = 0; slot < max; ++slot) {
+            probe_conn *c = &conns[slot];
+
+            if (c->fd < 0)
+                continue;
+
+            ms = (c->expire.tv_sec - ts.tv_sec)*1000.0 + (c->expire.tv_nsec - ts.tv_nsec)/1000000.0;
+            if ((wait < 0.0) || (ms < wait))
+                wait = ms > 0.0 ? ms : 0.0;
+        }
+
+        if ((n = epoll_wait(epfd, ev, probe_nevents, (int)wait + 1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            debug_fail_errno("Failed to wait for connections");
+        }
+
+        for (i = 0; i < n; ++i) {
+            probe_conn *c = &conns[ev[i].data.u32];
+            socklen_t len = sizeof(int);
+            int err = 0, r;
+
+            if (c->fd < 0)
+                continue;
+
+            if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+                err = errno;
+
+            close(c->fd);
+            c->fd = -1;
+
+            if (err == 0) {
+                probe_end(c, false, NULL, now);
+                --nflight;
+                continue;
+            }
+
+            // the next address may do better
+            c->addr = c->addr->ai_next;
+            if ((r = probe_connect(c, epfd, ev[i].data.u32)) != 0) {
+                probe_end(c, r < 0, strerror(r < 0 ? err : 0), now);
+                --nflight;
+            }
+        }
+
+        // more may be ready, take them all before expiring any
+        if (n == probe_nevents)
+            continue;
+
+        // give up on hosts that did not answer in time
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        for (slot = 0; slot < max; ++slot) {
+            probe_conn *c = &conns[slot];
+
+            if ((c->fd > -1) && ((c->expire.tv_sec < ts.tv_sec) ||
+                    ((c->expire.tv_sec == ts.tv_sec) && (c->expire.tv_nsec <= ts.tv_nsec)))) {
+                probe_end(c, true, "timed out", now);
+                --nflight;
+            }
+        }
+    }
+
+    if (probe_nrun > 0)
+        debug_print(1, "%lu hosts unreachable, %lu of them cached, skipping them",
+                    probe_nrun, ncached);
+    if (path != NULL)
+        probe_save(path, port);
+
+    close(epfd);
+    free(conns);
+    free(names);
+    free(path);
+}
+
+/*  True if host was found dead by probe_run.
+
+    Args:
+        host:   host as returned by next.
+*/
+bool probe_dead(const char *host)
+{
+    return (probe_n > 0) && (probe_table[probe_slot(host)].host != NULL);
+}
+
+/*  Number of hosts returned by next that probe_run found dead,
+    whether in the cache or by probing, so not the dead hosts in
+    the cache that are not in this run.
+*/
+unsigned long probe_ndead()
+{
+    return probe_nrun;
+}
+
+/*  Forget the dead hosts.
+*/
+void probe_free()
+{
+    unsigned long i;
+
+    for (i = 0; i < probe_tsize; ++i)
+        free(probe_table[i].host);
+    for (i = 0; i < probe_nkept; ++i)
+        free(probe_kept[i]);
+
+    free(probe_table);
+    free(probe_kept);
+    probe_table = NULL;
+    probe_kept = NULL;
+    probe_tsize = probe_n = probe_nrun = 0;
+    probe_nkept = 0;
+}
@@ -0,0 +1,85 @@
+/*
+ *  Reachability of hosts checked before a run, with a cache of dead hosts.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef probe_h
+    #define probe_h
+
+    #include <stdbool.h>
+    #include <time.h>
+
+    #define probe_port_default  "22"    // port probed, that of ssh
+    #define probe_ttl_default   300     // seconds dead hosts stay in the cache
+
+    /*  Connect to port on every host returned by next, all at once
+        with as many connections in flight as open file limits allow,
+        and remember the hosts that refuse, are unreachable or do not
+        answer within timeout.  Hosts that cannot be resolved are
+        left for the transport, eg, ssh may know them by another name.
+
+        Dead hosts are kept in cache with the time they were found
+        and are not probed again for ttl seconds.
+
+        Args:
+            next:       returns the next host or NULL when done.
+
+            port:       port to connect to.
+
+            timeout:    longest to wait for each connection.
+
+            cache:      file of dead hosts, NULL for the default
+                        $XDG_CACHE_HOME/sshall-dead or else
+                        ~/.cache/sshall-dead.
+
+            ttl:        seconds a dead host stays in the cache,
+                        0 for no cache.
+    */
+    void probe_run(char *(*next)(), const char *port, struct timespec timeout,
+                   const char *cache, long ttl);
+
+    /*  True if host was found dead by probe_run.
+
+        Args:
+            host:   host as returned by next.
+    */
+    bool probe_dead(const char *host);
+
+    /*  Number of hosts returned by next that probe_run found dead,
+        cached or probed, not counting cached hosts of other runs.
+    */
+    unsigned long probe_ndead();
+
+    /*  Forget the dead hosts.
+    */
+    void probe_free();
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ *  Status line showing the progress of a parallel run.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "progress.h"
+
+#define progress_sub    16  // latency buckets per power of two
+#define progress_nexp   40  // powers of two of microseconds tracked
+#define progress_nbucket (progress_sub*progress_nexp)
+#define progress_linemax 512 // longest status line
+
+static bool            progress_on = false;     // true if standard error is a terminal
+static bool            progress_drawn = false;  // true while the status line is shown
+static unsigned long   progress_total = 0;      // hosts in the run, 0 if unknown
+static unsigned long   progress_ndone = 0;      // hosts finished
+static unsigned long   progress_nfailed = 0;    // hosts finished with an error
+static struct timespec progress_start;          // start of the run
+static sched_stats     progress_last;           // last progress of the scheduler
+
+// log linear histogram of latency in microseconds, within 1/progress_sub
+static unsigned long   progress_hist[progress_nbucket];
+
+/*  Histogram bucket holding a latency of us microseconds.
+*/
+static unsigned progress_bucket(unsigned long us)
+{
+    unsigned e, b;
+
+    if (us < progress_sub)
+        return us;
+
+    // position of the leading bit picks the power, the next four the bucket
+    e = 8*sizeof(us) - 1 - __builtin_clzl(us);
+    b = (e-3)*progress_sub + ((us >> (e-4)) & (progress_sub-1));
+
+    return b < progress_nbucket ? b : progress_nbucket-1;
+}
+
+/*  Smallest latency in microseconds held by bucket b.
+*/
+static unsigned long progress_lower(unsigned b)
+{
+    unsigned e = b/progress_sub + 3;
+
+    if (b < progress_sub)
+        return b;
+
+    return (1UL << e) | ((unsigned long)(b % progress_sub) << (e-4));
+}
+
+/*  Latency in microseconds below which fraction q of hosts finished.
+*/
+static unsigned long progress_quantile(double q)
+{
+    unsigned long rank = (unsigned long)(q*progress_ndone + 0.999999), n = 0;
+    unsigned b;
+
+    for (b = 0; b < progress_nbucket; ++b)
+        if ((n += progress_hist[b]) >= rank)
+            return progress_lower(b);
+
+    return progress_lower(progress_nbucket-1);
+}
+
+/*  Format a latency in microseconds as milliseconds or seconds.
+*/
+static void progress_fmt_lat(char *buff, size_t size, unsigned long us)
+{
+    if (us < 1000000)
+        snprintf(buff, size, "%lums", us/1000);
+    else
+        snprintf(buff, size, "%.1fs", us/1000000.0);
+}
+
+/*  Start showing progress if standard error is a terminal,
+    otherwise every other call does nothing.
+
+    Args:
+        total:  number of hosts in the run, 0 if unknown.
+*/
+void progress_init(unsigned long total)
+{
+    progress_on = isatty(STDERR_FILENO);
+    progress_drawn = false;
+    progress_total = total;
+    progress_ndone = progress_nfailed = 0;
+    memset(&progress_last, 0, sizeof(progress_last));
+    memset(progress_hist, 0, sizeof(progress_hist));
+    clock_gettime(CLOCK_MONOTONIC, &progress_start);
+}
+
+/*  Count a finished host and its latency from launch to exit.
+
+    Args:
+        j:  finished host.
+*/
+void progress_add(const sched_job *j)
+{
+    struct timespec now;
+    long us;
+
+    if (!progress_on)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    us = (now.tv_sec - j->start.tv_sec)*1000000L + (now.tv_nsec - j->start.tv_nsec)/1000;
+
+    ++progress_hist[progress_bucket(us > 0 ? us : 0)];
+    ++progress_ndone;
+    if (j->timedout || (!j->cancelled && (j->status != 0)))
+        ++progress_nfailed;
+}
+
+/*  Write the status line over whatever is on the current line.
+*/
+static void progress_draw()
+{
+    char line[progress_linemax], p50[16], p95[16], p99[16];
+    struct timespec now;
+    double secs, rate;
+    unsigned long eta;
+    int n;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    secs = (now.tv_sec - progress_start.tv_sec) + (now.tv_nsec - progress_start.tv_nsec)/1e9;
+    rate = secs > 0.0 ? progress_ndone/secs : 0.0;
+
+    n = snprintf(line, sizeof(line), "\r%u launched, %u running, %lu done, %lu failed",
+                 progress_last.nlaunched, progress_last.nrunning,
+                 progress_ndone, progress_nfailed);
+
+    if (progress_last.nwaiting > 0)
+        n += snprintf(line+n, sizeof(line)-n, ", %u retrying", progress_last.nwaiting);
+
+    n += snprintf(line+n, sizeof(line)-n, ", %.1f hosts/s", rate);
+
+    if ((progress_total > progress_ndone) && (rate > 0.0)) {
+        eta = (unsigned long)((progress_total - progress_ndone)/rate);
+        n += snprintf(line+n, sizeof(line)-n, ", eta %lu:%02lu:%02lu",
+                      eta/3600, eta/60%60, eta%60);
+    }
+
+    if (progress_ndone > 0) {
+        progress_fmt_lat(p50, sizeof(p50), progress_quantile(0.50));
+        progress_fmt_lat(p95, sizeof(p95), progress_quantile(0.95));
+        progress_fmt_lat(p99, sizeof(p99), progress_quantile(0.99));
+        n += snprintf(line+n, sizeof(line)-n, ", p50 %s p95 %s p99 %s", p50, p95, p99);
+    }
+
+    // erase anything left from a longer line
+    snprintf(line+n, sizeof(line)-n, "\033[K");
+
+    if (write(STDERR_FILENO, line, strlen(line)) > 0)
+        progress_drawn = true;
+}
+
+/*  Redraw the status line with launched, running, finished and
+    failed hosts, throughput, time remaining and latency
+    percentiles.  Matches sched_opts.status.
+
+    Args:
+        s:  progress of the scheduler.
+*/
+void progress_status(const sched_stats *s)
+{
+    if (!progress_on)
+        return;
+
+    progress_last = *s;
+    progress_draw();
+}
+
+/*  Erase the status line, if drawn, so output can be printed
+    in its place.  It is drawn again at the next status.
+*/
+void progress_clear()
+{
+    if (!progress_drawn)
+        return;
+
+    if (write(STDERR_FILENO, "\r\033[K", 4) < 0)
+        return;
+    progress_drawn = false;
+}
+
+/*  Draw the status line a last time and leave it in place.
+*/
+void progress_end()
+{
+    if (!progress_on)
+        return;
+
+    progress_draw();
+    if (write(STDERR_FILENO, "\n", 1) < 0)
+        return;
+
+    progress_drawn = false;
+    progress_on = false;
+}
@@ -0,0 +1,72 @@
+/*
+ *  Status line showing the progress of a parallel run.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+#ifndef progress_h
+    #define progress_h
+
+    #include "sched.h"
+
+    /*  Start showing progress if standard error is a terminal,
+        otherwise every other call does nothing.
+
+        Args:
+            total:  number of hosts in the run, 0 if unknown.
+    */
+    void progress_init(unsigned long total);
+
+    /*  Count a finished host and its latency from launch to exit.
+
+        Args:
+            j:  finished host.
+    */
+    void progress_add(const sched_job *j);
+
+    /*  Redraw the status line with launched, running, finished and
+        failed hosts, throughput, time remaining and latency
+        percentiles.  Matches sched_opts.status.
+
+        Args:
+            s:  progress of the scheduler.
+    */
+    void progress_status(const sched_stats *s);
+
+    /*  Erase the status line, if drawn, so output can be printed
+        in its place.  It is drawn again at the next status.
+    */
+    void progress_clear();
+
+    /*  Draw the status line a last time and leave it in place.
+    */
+    void progress_end();
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ *  Token bucket limits on how fast commands are launched.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ratelimit.h"
+#include "debug.h"
+
+#define ratelimit_keymax 256    // longest group name
+
+/*  Setup a bucket holding burst tokens.
+*/
+static void ratelimit_fill(ratelimit_bucket *b, double rate, double burst)
+{
+    b->rate   = rate;
+    b->burst  = burst < 1.0 ? 1.0 : burst;
+    b->tokens = b->burst;
+    clock_gettime(CLOCK_MONOTONIC, &b->last);
+}
+
+/*  Add the tokens earned since b was last brought up to date and
+    return milliseconds until it holds a whole token.
+*/
+static double ratelimit_earn(ratelimit_bucket *b)
+{
+    struct timespec now;
+
+    if (b->rate <= 0.0)
+        return 0.0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    b->tokens += b->rate*((now.tv_sec - b->last.tv_sec) +
+                          (now.tv_nsec - b->last.tv_nsec)/1000000000.0);
+    if (b->tokens > b->burst)
+        b->tokens = b->burst;
+    b->last = now;
+
+    return b->tokens >= 1.0 ? 0.0 : (1.0 - b->tokens)/b->rate*1000.0;
+}
+
+/*  Write the name of the group of host to key.
+*/
+static void ratelimit_key(const char *host, char *key)
+{
+    struct in_addr addr;
+    const char *at, *dot;
+    size_t len;
+
+    // user@host reaches host
+    if ((at = strrchr(host, '@')) != NULL)
+        host = at + 1;
+
+    strncpy(key, host, ratelimit_keymax-1);
+    key[ratelimit_keymax-1] = '\0';
+
+    if (inet_pton(AF_INET, key, &addr) == 1)
+        *strrchr(key, '.') = '\0';
+
+    else if ((dot = strchr(key, '.')) != NULL)
+        memmove(key, dot+1, strlen(dot));
+
+    else {
+        for (len = strlen(key); (len > 0) && isdigit((unsigned char)key[len-1]); --len);
+        key[len] = '\0';
+    }
+}
+
+/*  Find or add the bucket of the group of host.
+*/
+static ratelimit_bucket *ratelimit_find(ratelimit *r, const char *host)
+{
+    char key[ratelimit_keymax];
+    ratelimit_group *g;
+    unsigned i;
+
+    ratelimit_key(host, key);
+
+    for (i = 0; i < r->ngroups; ++i)
+        if (strcmp(r->groups[i].key, key) == 0)
+            return &r->groups[i].b;
+
+    if (r->ngroups == r->maxgroups) {
+        r->maxgroups = r->maxgroups > 0 ? 2*r->maxgroups : 16;
+        if ((r->groups = realloc(r->groups, sizeof(ratelimit_group)*r->maxgroups)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+    }
+
+    g = &r->groups[r->ngroups++];
+    if ((g->key = strdup(key)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+    ratelimit_fill(&g->b, r->group_rate, r->group_burst);
+
+    debug_print(3, "rate limit group %s", g->key);
+
+    return &g->b;
+}
+
+/*  Setup a limiter.  Buckets start full so the first burst of
+    launches is never held back.
+
+    Args:
+        r:              limiter to setup.
+
+        rate:           launches per second overall, 0 for no limit.
+
+        burst:          most launches at once overall.
+
+        group_rate:     launches per second to each group of
+                        hosts, 0 for no limit.
+
+        group_burst:    most launches at once to each group.
+*/
+void ratelimit_init(ratelimit *r, double rate, double burst,
+                    double group_rate, double group_burst)
+{
+    ratelimit_fill(&r->all, rate, burst);
+    r->group_rate  = group_rate;
+    r->group_burst = group_burst;
+    r->groups      = NULL;
+    r->ngroups     = r->maxgroups = 0;
+}
+
+/*  Milliseconds until host may be launched.  Hosts are grouped
+    by the /24 network of an IPv4 address, else by the domain
+    after the first dot, else by the name without its trailing
+    digits, so node01 to node99 are one group.
+
+    Args:
+        r:      limiter.
+
+        host:   host to launch, NULL for the overall limit only.
+
+    Returns:
+        0 if host may be launched now.
+*/
+double ratelimit_wait(ratelimit *r, const char *host)
+{
+    double ms = ratelimit_earn(&r->all), gms;
+
+    if ((host != NULL) && (r->group_rate > 0.0) &&
+            ((gms = ratelimit_earn(ratelimit_find(r, host))) > ms))
+        ms = gms;
+
+    return ms;
+}
+
+/*  Spend the tokens for launching host.
+
+    Args:
+        r:      limiter.
+
+        host:   host being launched.
+*/
+void ratelimit_take(ratelimit *r, const char *host)
+{
+    ratelimit_earn(&r->all);
+    r->all.tokens -= 1.0;
+
+    if (r->group_rate > 0.0) {
+        ratelimit_bucket *b = ratelimit_find(r, host);
+        ratelimit_earn(b);
+        b->tokens -= 1.0;
+    }
+}
+
+/*  Free the buckets of groups.
+
+    Args:
+        r:      limiter.
+*/
+void ratelimit_free(ratelimit *r)
+{
+    unsigned i;
+
+    for (i = 0; i < r->ngroups; ++i)
+        free(r->groups[i].key);
+
+    free(r->groups);
+    r->groups = NULL;
+    r->ngroups = r->maxgroups = 0;
+}
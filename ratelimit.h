@@ -0,0 +1,112 @@
+/*
+ *  Token bucket limits on how fast commands are launched.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef ratelimit_h
+    #define ratelimit_h
+
+    #include <time.h>
+
+    /* tokens earned at a steady rate up to a burst, one spent per launch */
+    typedef struct {
+        double          rate;   // tokens earned per second, 0 for no limit
+        double          burst;  // most tokens held, at least one
+        double          tokens; // tokens held
+        struct timespec last;   // when tokens was brought up to date
+    } ratelimit_bucket;
+
+    /* bucket shared by the hosts of one group */
+    typedef struct {
+        char             *key;  // name of the group
+        ratelimit_bucket  b;
+    } ratelimit_group;
+
+    /* limits on launches overall and within each group of hosts */
+    typedef struct {
+        ratelimit_bucket  all;          // every launch
+        double            group_rate;   // launches per second in each group, 0 for no limit
+        double            group_burst;  // most launches at once in each group
+        ratelimit_group  *groups;       // buckets of groups seen so far
+        unsigned          ngroups;      // number of groups
+        unsigned          maxgroups;    // allocated length of groups
+    } ratelimit;
+
+    /*  Setup a limiter.  Buckets start full so the first burst of
+        launches is never held back.
+
+        Args:
+            r:              limiter to setup.
+
+            rate:           launches per second overall, 0 for no limit.
+
+            burst:          most launches at once overall.
+
+            group_rate:     launches per second to each group of
+                            hosts, 0 for no limit.
+
+            group_burst:    most launches at once to each group.
+    */
+    void ratelimit_init(ratelimit *r, double rate, double burst,
+                        double group_rate, double group_burst);
+
+    /*  Milliseconds until host may be launched.  Hosts are grouped
+        by the /24 network of an IPv4 address, else by the domain
+        after the first dot, else by the name without its trailing
+        digits, so node01 to node99 are one group.
+
+        Args:
+            r:      limiter.
+
+            host:   host to launch, NULL for the overall limit only.
+
+        Returns:
+            0 if host may be launched now.
+    */
+    double ratelimit_wait(ratelimit *r, const char *host);
+
+    /*  Spend the tokens for launching host.
+
+        Args:
+            r:      limiter.
+
+            host:   host being launched.
+    */
+    void ratelimit_take(ratelimit *r, const char *host);
+
+    /*  Free the buckets of groups.
+
+        Args:
+            r:      limiter.
+    */
+    void ratelimit_free(ratelimit *r);
+
+#endif
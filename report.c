@@ -0,0 +1,205 @@
+/*
+ *  Per host result records for analysis.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "report.h"
+#include "debug.h"
+
+#define report_namemax 1024 // longest host name written in full
+
+static int             report_fd = -1;      // file of records, -1 if not open
+static bool            report_csv = false;  // comma separated instead of json
+static struct timespec report_offset;       // wall clock minus monotonic clock
+
+static const char report_header[] =
+    "host,exit,signal,timed_out,cancelled,retries,launch,first_byte,end,"
+    "stdout_bytes,stderr_bytes,user_s,sys_s,maxrss_kb\n";
+
+/*  Open path for records, truncating it.  Records are comma
+    separated values with a header if path ends in .csv and
+    JSON objects, one per line, otherwise.  Fails on error.
+
+    Args:
+        path:   file to write records to.
+*/
+void report_open(const char *path)
+{
+    struct timespec real, mono;
+    size_t len = strlen(path);
+
+    if ((report_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) < 0)
+        debug_fail_errno("Failed to open report %s", path);
+
+    report_csv = (len > 4) && (strcmp(path+len-4, ".csv") == 0);
+
+    if (report_csv && (write(report_fd, report_header, sizeof(report_header)-1) < 0))
+        debug_fail_errno("Failed to write report");
+
+    // times are kept on the monotonic clock, records use the wall clock
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    report_offset.tv_sec  = real.tv_sec - mono.tv_sec;
+    report_offset.tv_nsec = real.tv_nsec - mono.tv_nsec;
+}
+
+/*  Format a monotonic time as seconds since the epoch, or
+    empty, null in json, if it is zero.
+*/
+static void report_time(char *buff, size_t size, const struct timespec *t)
+{
+    long long ns;
+
+    if ((t->tv_sec == 0) && (t->tv_nsec == 0)) {
+        snprintf(buff, size, "%s", report_csv ? "" : "null");
+        return;
+    }
+
+    ns = (long long)(t->tv_sec + report_offset.tv_sec)*1000000000LL +
+         t->tv_nsec + report_offset.tv_nsec;
+    snprintf(buff, size, "%lld.%06lld", ns/1000000000LL, ns%1000000000LL/1000);
+}
+
+/*  Copy a host name into buff, quoted for json or csv.
+*/
+static void report_quote(char *buff, size_t size, const char *host)
+{
+    size_t n = 0;
+
+    buff[n++] = '"';
+
+    for (; (*host != '\0') && (n+3 < size); ++host) {
+        if (report_csv) {
+            if (*host == '"')
+                buff[n++] = '"';
+        }
+        else if ((*host == '"') || (*host == '\\'))
+            buff[n++] = '\\';
+        else if ((unsigned char)*host < 0x20)
+            continue;
+        buff[n++] = *host;
+    }
+
+    buff[n++] = '"';
+    buff[n] = '\0';
+}
+
+/*  Seconds in a timeval.
+*/
+static double report_secs(const struct timeval *t)
+{
+    return t->tv_sec + t->tv_usec/1000000.0;
+}
+
+/*  Write the record of a finished host with its exit status or
+    signal, launch, first output and exit times, bytes of output,
+    whether it timed out or was cancelled, retries and resource
+    usage.  Each record is written whole and at once so the file
+    can be read while the run goes on.
+
+    Args:
+        j:  finished host.
+*/
+void report_add(const sched_job *j)
+{
+    char host[2*report_namemax+3], launch[32], first[32], end[32];
+    char code[16] = "", sig[16] = "";
+    char *rec;
+    int r;
+
+    if (report_fd < 0)
+        return;
+
+    report_quote(host, sizeof(host), j->host);
+    report_time(launch, sizeof(launch), &j->start);
+    report_time(first, sizeof(first), &j->first);
+    report_time(end, sizeof(end), &j->end);
+
+    // exactly one of exit and signal is set
+    if (WIFSIGNALED(j->status)) {
+        snprintf(code, sizeof(code), "%s", report_csv ? "" : "null");
+        snprintf(sig, sizeof(sig), "%d", WTERMSIG(j->status));
+    }
+    else {
+        snprintf(code, sizeof(code), "%d", WEXITSTATUS(j->status));
+        snprintf(sig, sizeof(sig), "%s", report_csv ? "" : "null");
+    }
+
+    if (report_csv)
+        r = asprintf(&rec, "%s,%s,%s,%d,%d,%u,%s,%s,%s,%zu,%zu,%.6f,%.6f,%ld\n",
+                     host, code, sig, j->timedout, j->cancelled, j->attempt,
+                     launch, first, end,
+                     j->nbytes[sched_out], j->nbytes[sched_err],
+                     report_secs(&j->usage.ru_utime), report_secs(&j->usage.ru_stime),
+                     j->usage.ru_maxrss);
+    else
+        r = asprintf(&rec, "{\"host\":%s,\"exit\":%s,\"signal\":%s,\"timed_out\":%s,"
+                     "\"cancelled\":%s,\"retries\":%u,\"launch\":%s,\"first_byte\":%s,\"end\":%s,"
+                     "\"stdout_bytes\":%zu,\"stderr_bytes\":%zu,"
+                     "\"user_s\":%.6f,\"sys_s\":%.6f,\"maxrss_kb\":%ld}\n",
+                     host, code, sig, j->timedout ? "true" : "false",
+                     j->cancelled ? "true" : "false", j->attempt,
+                     launch, first, end, j->nbytes[sched_out], j->nbytes[sched_err],
+                     report_secs(&j->usage.ru_utime), report_secs(&j->usage.ru_stime),
+                     j->usage.ru_maxrss);
+
+    if (r < 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    // one append per record, readers never see half of one
+    if (write(report_fd, rec, r) < 0)
+        debug_warn_errno("Failed to write report");
+
+    free(rec);
+}
+
+/*  Close the file of records, if open.
+*/
+void report_close()
+{
+    if (report_fd < 0)
+        return;
+
+    close(report_fd);
+    report_fd = -1;
+}
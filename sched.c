@@ -0,0 +1,1132 @@
+/*
+ *  Single process scheduler for running commands on many hosts.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "sched.h"
+#include "debug.h"
+#include "spawn.h"
+
+#define sched_nevents 64            // maximum events per epoll_wait
+#define sched_sigtag  UINT64_MAX    // epoll tag for the signalfd
+#define sched_readlen 65536         // largest read when streaming output
+
+/* lines printed around the go signal by synchronized commands */
+#define sched_ready_mark "@@sshall-ready@@"
+#define sched_go_mark    "@@sshall-go@@"
+
+/* epoll tags encode the job slot and stream of each pipe */
+#define sched_tag(slot, s)  (((uint64_t)(slot) << 1) | (s))
+#define sched_tag_slot(t)   ((unsigned)((t) >> 1))
+#define sched_tag_stream(t) ((sched_stream)((t) & 1))
+
+/* progress of the current synchronized wave */
+typedef struct {
+    unsigned        n;          // number of waves started
+    unsigned        nhosts;     // hosts launched in this wave
+    unsigned        nready;     // hosts connected and waiting to fire
+    unsigned        nacks;      // hosts that acknowledged the go signal
+    bool            fired;      // true once the go signal was sent
+    struct timespec first;      // arrival of first acknowledgement
+    struct timespec last;       // arrival of last acknowledgement
+} sched_wave;
+
+/* progress of the current batch in rollout mode */
+typedef struct {
+    unsigned        n;          // number of batches started
+    unsigned        size;       // hosts in this batch
+    unsigned        nlaunched;  // new hosts launched in this batch
+} sched_batch;
+
+/* a host waiting to be launched again after a transport failure,
+   or for the first time if held back by the rate limit of its group */
+typedef struct {
+    sched_job       job;        // last attempt, holding host, index and output, pid 0 if held
+    struct timespec due;        // when to launch again
+} sched_retry;
+
+/* state shared by the scheduler helpers */
+typedef struct {
+    const sched_opts *opts;
+    sched_job        *jobs;     // one slot per command in flight
+    unsigned          nrunning; // number of occupied slots
+    unsigned          nlaunched;// number of hosts taken from opts->next
+    char            **argv;     // argument vector reused for each launch
+    unsigned          hostarg;  // index of host in argv
+    int               epfd;     // epoll instance
+    int               sigfd;    // signalfd receiving SIGCHLD
+    int               in;       // standard input for commands
+    sched_wave        wave;     // current wave in sync mode
+    sched_batch       batch;    // current batch in rollout mode
+    struct timespec   deadline; // end of the run, zero if none
+    unsigned          ntimedout;// number of commands that ran out of time
+    unsigned          nskipped; // hosts not launched before the deadline or the end of the run
+    unsigned          nfailed;  // hosts passed to opts->done that failed or timed out
+    unsigned          nsucceeded; // hosts passed to opts->done that exited with status zero
+    unsigned          nunstarted; // hosts passed to opts->done in sync mode before they started
+    bool              stopped;  // true once the run ended early
+    sched_retry      *retry;    // hosts waiting to be retried
+    unsigned          nretry;   // number of hosts in retry
+    unsigned          retrymax; // allocated length of retry
+    unsigned          nheld;    // hosts in retry held back by the rate limit of their group
+    int               ratewait; // milliseconds until opts->rate allows a launch, 0 if it does
+    bool              more;     // false once opts->next runs out
+    struct timespec   ticked;   // last call to opts->status
+} sched_state;
+
+/*  Milliseconds elapsed from a to b.
+*/
+static double sched_ms(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec)*1000.0 + (b->tv_nsec - a->tv_nsec)/1000000.0;
+}
+
+/*  True if t is set, ie, not zero.
+*/
+static bool sched_ts_set(const struct timespec *t)
+{
+    return (t->tv_sec != 0) || (t->tv_nsec != 0);
+}
+
+/*  Store a plus b in t.
+*/
+static void sched_ts_add(struct timespec *t, const struct timespec *a,
+                         const struct timespec *b)
+{
+    t->tv_sec  = a->tv_sec + b->tv_sec;
+    t->tv_nsec = a->tv_nsec + b->tv_nsec;
+    if (t->tv_nsec >= 1000000000L) {
+        ++t->tv_sec;
+        t->tv_nsec -= 1000000000L;
+    }
+}
+
+/*  Return a job to its free state.
+*/
+static void sched_job_clear(sched_job *j)
+{
+    j->host   = NULL;
+    j->pid    = 0;
+    j->status = 0;
+    j->reaped = false;
+    j->in     = -1;
+    j->phase  = sched_started;
+    j->linelen = 0;
+    j->priv   = NULL;
+    j->nkill  = 0;
+    j->timedout = false;
+    j->cancelled = false;
+    j->attempt = 0;
+    j->first.tv_sec = j->first.tv_nsec = 0;
+    j->nbytes[sched_out] = j->nbytes[sched_err] = 0;
+    j->expire.tv_sec = j->expire.tv_nsec = 0;
+    j->fd[sched_out] = j->fd[sched_err] = -1;
+    outbuf_init(&j->out);
+}
+
+/*  Count output read from a stream of a job.
+*/
+static void sched_count(sched_job *j, sched_stream s, size_t len)
+{
+    if ((j->nbytes[sched_out] == 0) && (j->nbytes[sched_err] == 0))
+        clock_gettime(CLOCK_MONOTONIC, &j->first);
+
+    j->nbytes[s] += len;
+}
+
+/*  Pass output to opts->output or capture it in j->out.
+*/
+static void sched_capture(sched_state *st, sched_job *j, sched_stream s,
+                          const char *data, size_t len)
+{
+    if (len == 0)
+        return;
+
+    sched_count(j, s, len);
+
+    if (st->opts->output != NULL)
+        st->opts->output(j, s, data, len);
+    else
+        outbuf_append(&j->out, data, len);
+}
+
+/*  Stop watching and close one output pipe of a job.
+*/
+static void sched_close(sched_state *st, sched_job *j, sched_stream s)
+{
+    if (epoll_ctl(st->epfd, EPOLL_CTL_DEL, j->fd[s], NULL) < 0)
+        debug_warn_errno("Failed to remove pipe from epoll");
+
+    close(j->fd[s]);
+    j->fd[s] = -1;
+}
+
+/*  True once the deadline of the run has passed.
+*/
+static bool sched_overdue(sched_state *st, const struct timespec *now)
+{
+    return sched_ts_set(&st->deadline) && (sched_ms(&st->deadline, now) >= 0.0);
+}
+
+/*  Pass a job to opts->done and free whatever it did not take.
+*/
+static void sched_done(sched_state *st, sched_job *j)
+{
+    // hosts cancelled by us neither failed nor succeeded
+    if (j->timedout || (!j->cancelled && (j->status != 0)))
+        ++st->nfailed;
+    else if (!j->cancelled)
+        ++st->nsucceeded;
+
+    if (st->opts->sync && !j->cancelled && (j->phase != sched_started))
+        ++st->nunstarted;
+
+    st->opts->done(j);
+
+    free(j->host);
+    outbuf_free(&j->out);
+}
+
+/*  True if the command failed to reach its host and should be
+    launched again.  Output already passed to opts->output cannot
+    be taken back, so a command that printed some has run and is
+    not launched again, eg, a relay that sent back records.
+*/
+static bool sched_retryable(sched_state *st, const sched_job *j)
+{
+    struct timespec now;
+
+    if ((st->opts->unreachable < 0) || j->timedout || j->cancelled ||
+            ((st->opts->output != NULL) && (j->nbytes[sched_out] > 0)) ||
+            (j->attempt >= st->opts->retries) || !WIFEXITED(j->status) ||
+            (WEXITSTATUS(j->status) != st->opts->unreachable))
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return !sched_overdue(st, &now);
+}
+
+/*  Add a copy of j to the retry list, due in ms milliseconds.
+*/
+static sched_retry *sched_wait(sched_state *st, const sched_job *j, long ms)
+{
+    struct timespec wait;
+    sched_retry *r;
+
+    if (st->nretry == st->retrymax) {
+        st->retrymax = st->retrymax > 0 ? 2*st->retrymax : 16;
+        if ((st->retry = realloc(st->retry, sizeof(sched_retry)*st->retrymax)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+    }
+
+    r = &st->retry[st->nretry++];
+    r->job = *j;
+
+    wait.tv_sec  = ms/1000;
+    wait.tv_nsec = (ms%1000)*1000000L;
+    clock_gettime(CLOCK_MONOTONIC, &r->due);
+    sched_ts_add(&r->due, &r->due, &wait);
+
+    return r;
+}
+
+/*  Hold back a new host until the rate limit of its group allows
+    it to launch, in ms milliseconds.  Its position is taken now.
+*/
+static void sched_hold(sched_state *st, const char *host, double ms)
+{
+    sched_job j;
+
+    sched_job_clear(&j);
+    if ((j.host = strdup(host)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+    j.index = st->nlaunched++;
+
+    sched_wait(st, &j, (long)ms + 1);
+    ++st->nheld;
+
+    debug_print(3, "%s held back %.0f ms by its rate limit", host, ms);
+}
+
+/*  Drop a host from the retry list without launching it again,
+    passing its last attempt to opts->done, or counting it as not
+    started if it never ran.
+*/
+static void sched_drop(sched_state *st, sched_job *j)
+{
+    if (j->pid != 0)
+        sched_done(st, j);
+
+    else {
+        free(j->host);
+        outbuf_free(&j->out);
+        --st->nheld;
+        ++st->nskipped;
+    }
+}
+
+/*  Move a job that failed to reach its host to the retry list,
+    due after a backoff that doubles with each attempt.  Half of
+    the backoff is random so hosts turned away at the same moment,
+    eg, by MaxStartups, do not all return at once.
+*/
+static void sched_defer(sched_state *st, const sched_job *j)
+{
+    sched_retry *r;
+    double ms = sched_backoff;
+    unsigned i;
+    long lms;
+
+    for (i = 0; (i < j->attempt) && (ms < sched_backoff_max); ++i)
+        ms *= 2.0;
+    if (ms > sched_backoff_max)
+        ms = sched_backoff_max;
+    lms = (long)(ms/2.0 + ms/2.0*((double)random()/RAND_MAX));
+
+    r = sched_wait(st, j, lms);
+    ++r->job.attempt;
+
+    debug_print(2, "%s unreachable, retry %u of %u in %ld ms",
+                j->host, r->job.attempt, st->opts->retries, lms);
+}
+
+/*  Hand a job to opts->done, or to the retry list if it failed to
+    reach its host, and free its slot once the command has exited
+    and both of its pipes have been drained.
+*/
+static void sched_finish(sched_state *st, sched_job *j)
+{
+    if (!j->reaped || (j->fd[sched_out] > -1) || (j->fd[sched_err] > -1))
+        return;
+
+    debug_print(3, "finished %s with status %d", j->host, j->status);
+
+    // the first output marks a working connection, how long the
+    // command runs after that says nothing about congestion
+    if (st->opts->adapt != NULL) {
+        bool out = (j->first.tv_sec != 0) || (j->first.tv_nsec != 0);
+
+        adapt_done(st->opts->adapt, out ? sched_ms(&j->start, &j->first) : -1.0,
+                   (j->timedout && !out) ||
+                   ((st->opts->unreachable > -1) && WIFEXITED(j->status) &&
+                    (WEXITSTATUS(j->status) == st->opts->unreachable)));
+    }
+
+    if (j->phase == sched_ready)
+        --st->wave.nready;
+    if (j->in > -1)
+        close(j->in);
+
+    // keep any partial marker line, it was real output
+    sched_capture(st, j, sched_out, j->line, j->linelen);
+
+    // the retry list takes the host, output and callback state
+    if (sched_retryable(st, j))
+        sched_defer(st, j);
+    else
+        sched_done(st, j);
+
+    sched_job_clear(j);
+    --st->nrunning;
+}
+
+/*  Spawn the remote command for host in a free slot, keeping a
+    copy of the host name.  If prev is set, host is being retried
+    and the slot takes over the host, position and callback state
+    of its last attempt instead.  A host whose command cannot be
+    spawned is passed to opts->done at once as failed.
+*/
+static void sched_launch(sched_state *st, const char *host, sched_job *prev)
+{
+    unsigned slot;
+    int pfd[sched_nstream][2];
+    int ipfd[2] = {st->in, -1};
+    sched_stream s;
+    sched_job *j;
+
+    for (slot = 0; st->jobs[slot].host != NULL; ++slot);
+    j = &st->jobs[slot];
+
+    if (st->opts->input != NULL)
+        ipfd[0] = st->opts->input(prev != NULL ? prev->index : st->nlaunched);
+
+    for (s = sched_out; s < sched_nstream; ++s)
+        if (pipe2(pfd[s], O_CLOEXEC) < 0)
+            debug_fail_errno("Failed to create pipe");
+
+    // synchronized commands wait for the go signal on their input
+    if (st->opts->sync && (pipe2(ipfd, O_CLOEXEC) < 0))
+        debug_fail_errno("Failed to create pipe");
+
+    st->argv[st->hostarg] = (char*)host;
+    j->pid = spawn_cmd(st->argv, ipfd[0], pfd[sched_out][1], pfd[sched_err][1]);
+
+    for (s = sched_out; s < sched_nstream; ++s)
+        close(pfd[s][1]);
+    if (st->opts->sync || (st->opts->input != NULL))
+        close(ipfd[0]);
+
+    if (j->pid < 0) {
+        // out of processes, fewer commands in flight may fit
+        if ((st->opts->adapt != NULL) && (errno == EAGAIN))
+            adapt_backoff(st->opts->adapt);
+        debug_warn_errno("Failed to spawn %s for %s", st->argv[0], host);
+        for (s = sched_out; s < sched_nstream; ++s)
+            close(pfd[s][0]);
+        if (st->opts->sync)
+            close(ipfd[1]);
+    }
+    else
+        debug_print(3, "launched %s as pid %d", host, j->pid);
+
+    clock_gettime(CLOCK_MONOTONIC, &j->start);
+    if (sched_ts_set(&st->opts->timeout))
+        sched_ts_add(&j->expire, &j->start, &st->opts->timeout);
+
+    if ((prev != NULL) && (prev->pid == 0))
+        --st->nheld;
+
+    if (prev != NULL) {
+        j->host    = prev->host;
+        j->index   = prev->index;
+        j->priv    = prev->priv;
+        j->attempt = prev->attempt;
+        outbuf_free(&prev->out);
+    }
+    else {
+        if ((j->host = strdup(host)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        j->index = st->nlaunched++;
+    }
+
+    // the host failed without running, as a shell that cannot
+    // execute its command, and keeps its place in the output
+    if (j->pid < 0) {
+        j->pid    = 0;
+        j->status = W_EXITCODE(127, 0);
+        j->reaped = true;
+        j->end    = j->start;
+        sched_done(st, j);
+        sched_job_clear(j);
+        return;
+    }
+
+    if (st->opts->sync) {
+        j->in = ipfd[1];
+        j->phase = sched_connecting;
+        ++st->wave.nhosts;
+    }
+
+    for (s = sched_out; s < sched_nstream; ++s) {
+        struct epoll_event ev = {.events = EPOLLIN, .data.u64 = sched_tag(slot, s)};
+
+        j->fd[s] = pfd[s][0];
+        if (epoll_ctl(st->epfd, EPOLL_CTL_ADD, j->fd[s], &ev) < 0)
+            debug_fail_errno("Failed to add pipe to epoll");
+    }
+
+    ++st->nrunning;
+}
+
+/*  Read the marker lines printed by a synchronized command before
+    it starts, one byte at a time so no real output is consumed.
+    Any other lines are kept as output.
+*/
+static ssize_t sched_read_mark(sched_state *st, sched_job *j)
+{
+    const char *mark = j->phase == sched_connecting ? sched_ready_mark : sched_go_mark;
+    ssize_t r;
+    char c;
+
+    if ((r = read(j->fd[sched_out], &c, 1)) <= 0)
+        return r;
+
+    if (c != '\n') {
+        if (j->linelen == sched_linemax) {
+            sched_capture(st, j, sched_out, j->line, j->linelen);
+            j->linelen = 0;
+        }
+        j->line[j->linelen++] = c;
+        return r;
+    }
+
+    if ((j->linelen != strlen(mark)) || (memcmp(j->line, mark, j->linelen) != 0)) {
+        sched_capture(st, j, sched_out, j->line, j->linelen);
+        sched_capture(st, j, sched_out, &c, 1);
+    }
+
+    // connected, wait for the rest of the wave
+    else if (j->phase == sched_connecting) {
+        j->phase = sched_ready;
+        ++st->wave.nready;
+    }
+
+    // the remote command is starting
+    else if (j->phase == sched_fired) {
+        clock_gettime(CLOCK_MONOTONIC, &st->wave.last);
+        if (st->wave.nacks++ == 0)
+            st->wave.first = st->wave.last;
+        j->phase = sched_started;
+    }
+
+    j->linelen = 0;
+    return r;
+}
+
+/*  Perform a single read from one pipe of a job, passing the
+    result to opts->output or capturing it in j->out.
+*/
+static ssize_t sched_read_stream(sched_state *st, sched_job *j, sched_stream s)
+{
+    char buff[sched_readlen];
+    ssize_t r;
+
+    if (st->opts->output == NULL)
+        r = outbuf_read(&j->out, j->fd[s]);
+
+    else if ((r = read(j->fd[s], buff, sizeof(buff))) > 0)
+        st->opts->output(j, s, buff, r);
+
+    if (r > 0)
+        sched_count(j, s, r);
+
+    return r;
+}
+
+/*  Read available output from one pipe of a job.
+*/
+static void sched_read(sched_state *st, uint64_t tag)
+{
+    sched_job *j = &st->jobs[sched_tag_slot(tag)];
+    sched_stream s = sched_tag_stream(tag);
+    ssize_t r;
+
+    // pipe was already closed earlier in this batch of events
+    if (j->fd[s] < 0)
+        return;
+
+    if ((s == sched_out) && (j->phase != sched_started))
+        r = sched_read_mark(st, j);
+    else
+        r = sched_read_stream(st, j, s);
+
+    if (r > 0)
+        return;
+
+    if ((r < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+        return;
+
+    if (r < 0)
+        debug_warn_errno("Failed to read output of %s", j->host);
+
+    sched_close(st, j, s);
+    sched_finish(st, j);
+}
+
+/*  Reap every exited child and record its status and resource usage.
+*/
+static void sched_reap(sched_state *st)
+{
+    struct signalfd_siginfo si;
+    struct rusage usage;
+    unsigned slot;
+    int status;
+    pid_t id;
+
+    // drain pending notifications, several exits may share one
+    while (read(st->sigfd, &si, sizeof(si)) == sizeof(si));
+
+    while ((id = wait4(-1, &status, WNOHANG, &usage)) > 0) {
+        for (slot = 0; slot < st->opts->npar; ++slot)
+            if ((st->jobs[slot].host != NULL) && (st->jobs[slot].pid == id))
+                break;
+
+        if (slot == st->opts->npar) {
+            debug_print(3, "reaped unknown child %d", id);
+            continue;
+        }
+
+        st->jobs[slot].status = status;
+        st->jobs[slot].usage  = usage;
+        st->jobs[slot].reaped = true;
+        clock_gettime(CLOCK_MONOTONIC, &st->jobs[slot].end);
+        sched_finish(st, &st->jobs[slot]);
+    }
+}
+
+/*  Stop a command that ran out of time or was cancelled, with
+    SIGTERM first and SIGKILL once sched_grace seconds have passed.
+    A command that already exited but left its pipes open, eg, to
+    a background process, is finished without waiting for them.
+*/
+static void sched_kill(sched_state *st, sched_job *j, const struct timespec *now)
+{
+    const struct timespec grace = {.tv_sec = sched_grace, .tv_nsec = 0};
+    sched_stream s;
+
+    if (!j->timedout && !j->cancelled) {
+        debug_print(2, "%s timed out", j->host);
+        j->timedout = true;
+        ++st->ntimedout;
+    }
+
+    if (j->reaped) {
+        for (s = sched_out; s < sched_nstream; ++s)
+            if (j->fd[s] > -1)
+                sched_close(st, j, s);
+        sched_finish(st, j);
+        return;
+    }
+
+    if (kill(j->pid, j->nkill == 0 ? SIGTERM : SIGKILL) < 0)
+        debug_warn_errno("Failed to stop command on %s", j->host);
+
+    // after SIGKILL only the pipes may be left to wait for
+    sched_ts_add(&j->expire, now, &grace);
+    ++j->nkill;
+}
+
+/*  Stop every command that ran out of time, or all of them past
+    the deadline.
+
+    Returns:
+        milliseconds until the next timeout is due, -1 if none.
+*/
+static int sched_expire(sched_state *st)
+{
+    struct timespec now;
+    double next = -1.0, ms;
+    bool overdue;
+    unsigned slot;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    overdue = sched_overdue(st, &now);
+
+    for (slot = 0; slot < st->opts->npar; ++slot) {
+        sched_job *j = &st->jobs[slot];
+
+        if (j->host == NULL)
+            continue;
+
+        if ((overdue && !j->timedout && !j->cancelled) ||
+                (sched_ts_set(&j->expire) && (sched_ms(&j->expire, &now) >= 0.0)))
+            sched_kill(st, j, &now);
+
+        // the slot is free if the job finished
+        if ((j->host != NULL) && sched_ts_set(&j->expire) &&
+                (((ms = sched_ms(&now, &j->expire)) < next) || (next < 0.0)))
+            next = ms;
+    }
+
+    if (!overdue && sched_ts_set(&st->deadline) &&
+            (((ms = sched_ms(&now, &st->deadline)) < next) || (next < 0.0)))
+        next = ms;
+
+    // round up so we never wake just before a timeout
+    return next < 0.0 ? -1 : (int)next + 1;
+}
+
+/*  Send the go signal to every connected host in the wave.
+*/
+static void sched_fire(sched_state *st)
+{
+    unsigned slot;
+
+    debug_print(2, "firing wave %u", st->wave.n);
+
+    for (slot = 0; slot < st->opts->npar; ++slot) {
+        sched_job *j = &st->jobs[slot];
+
+        if ((j->host == NULL) || (j->phase != sched_ready))
+            continue;
+
+        if (write(j->in, "\n", 1) < 0)
+            debug_warn_errno("Failed to start command on %s", j->host);
+
+        close(j->in);
+        j->in = -1;
+        j->phase = sched_fired;
+    }
+
+    st->wave.nready = 0;
+    st->wave.fired = true;
+}
+
+/*  Report the start skew of a finished wave and reset for the next.
+*/
+static void sched_wave_end(sched_state *st)
+{
+    sched_wave *w = &st->wave;
+
+    if (w->nhosts > 0) {
+        if (w->nacks > 0)
+            debug_print(1, "wave %u: started %u of %u hosts with %.3f ms skew",
+                        w->n, w->nacks, w->nhosts, sched_ms(&w->first, &w->last));
+        else
+            debug_print(1, "wave %u: no hosts started", w->n);
+    }
+
+    w->nhosts = w->nready = w->nacks = 0;
+    w->fired = false;
+    ++w->n;
+}
+
+/*  Number of commands allowed in flight.
+*/
+static unsigned sched_limit(const sched_state *st)
+{
+    unsigned limit = st->opts->adapt != NULL ? st->opts->adapt->limit : st->opts->npar;
+
+    return st->opts->rollout && (st->batch.size < limit) ? st->batch.size : limit;
+}
+
+/*  Find the retry that has been due longest.
+
+    Returns:
+        position in st->retry, or -1 if none are due yet.
+*/
+static int sched_due(const sched_state *st)
+{
+    struct timespec now;
+    unsigned i;
+    int due = -1;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < st->nretry; ++i)
+        if ((sched_ms(&st->retry[i].due, &now) >= 0.0) &&
+                ((due < 0) || (sched_ms(&st->retry[i].due, &st->retry[due].due) > 0.0)))
+            due = i;
+
+    return due;
+}
+
+/*  Milliseconds until the next retry is due, rounded up.
+*/
+static int sched_retry_wait(const sched_state *st)
+{
+    struct timespec now;
+    double next = -1.0, ms;
+    unsigned i;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (i = 0; i < st->nretry; ++i)
+        if (((ms = sched_ms(&now, &st->retry[i].due)) < next) || (next < 0.0))
+            next = ms;
+
+    return next < 0.0 ? 0 : (int)next + 1;
+}
+
+/*  Launch hosts until every slot is full or there are none left
+    to launch yet, taking retries that are due before new hosts.
+    Stops early, setting st->ratewait, when opts->rate allows no
+    more launches yet.  A new host whose group is over its rate
+    is held back on the retry list while later hosts go ahead, up
+    to opts->npar of them.  Clears st->more once opts->next runs out.
+*/
+static void sched_fill(sched_state *st)
+{
+    ratelimit *rate = st->opts->rate;
+    sched_retry r;
+    char *host;
+    double ms;
+    int i;
+
+    st->ratewait = 0;
+
+    while (st->nrunning < sched_limit(st)) {
+        if ((rate != NULL) && ((ms = ratelimit_wait(rate, NULL)) > 0.0)) {
+            st->ratewait = (int)ms + 1;
+            return;
+        }
+
+        if ((st->nretry > 0) && ((i = sched_due(st)) > -1)) {
+            r = st->retry[i];
+
+            // its group may still be over its rate
+            if ((rate != NULL) && ((ms = ratelimit_wait(rate, r.job.host)) > 0.0)) {
+                st->retry[i] = st->retry[--st->nretry];
+                sched_wait(st, &r.job, (long)ms + 1);
+                continue;
+            }
+
+            st->retry[i] = st->retry[--st->nretry];
+            if (rate != NULL)
+                ratelimit_take(rate, r.job.host);
+            sched_launch(st, r.job.host, &r.job);
+        }
+
+        else if (!st->more || (st->nheld >= st->opts->npar) ||
+                 (st->opts->rollout && (st->batch.nlaunched >= st->batch.size)))
+            return;
+
+        else if ((host = st->opts->next()) == NULL) {
+            st->more = false;
+            return;
+        }
+
+        else if ((rate != NULL) && ((ms = ratelimit_wait(rate, host)) > 0.0)) {
+            sched_hold(st, host, ms);
+            ++st->batch.nlaunched;
+        }
+
+        else {
+            if (rate != NULL)
+                ratelimit_take(rate, host);
+            sched_launch(st, host, NULL);
+            ++st->batch.nlaunched;
+        }
+    }
+}
+
+/*  Launch nothing more, not even retries, counting the hosts
+    left as not started.
+*/
+static void sched_stop(sched_state *st)
+{
+    while (st->more && (st->opts->next() != NULL))
+        ++st->nskipped;
+    while (st->nretry > 0)
+        sched_drop(st, &st->retry[--st->nretry].job);
+    st->more = false;
+}
+
+/*  True once enough hosts failed or succeeded to end the run.
+*/
+static bool sched_enough(const sched_state *st)
+{
+    return ((st->opts->max_failures > 0) && (st->nfailed >= st->opts->max_failures)) ||
+           ((st->opts->until_success > 0) && (st->nsucceeded >= st->opts->until_success));
+}
+
+/*  Stop every command still running, without counting them as
+    timed out.  Commands that exited are left to finish draining.
+*/
+static void sched_cancel(sched_state *st)
+{
+    struct timespec now;
+    unsigned slot;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    for (slot = 0; slot < st->opts->npar; ++slot) {
+        sched_job *j = &st->jobs[slot];
+
+        if ((j->host == NULL) || j->reaped || j->cancelled)
+            continue;
+
+        debug_print(2, "cancelling %s", j->host);
+        j->cancelled = true;
+        sched_kill(st, j, &now);
+    }
+}
+
+/*  Fill in the progress of the run.
+*/
+static void sched_stats_get(const sched_state *st, sched_stats *s)
+{
+    s->nlaunched  = st->nlaunched;
+    s->nrunning   = st->nrunning;
+    s->nwaiting   = st->nretry;
+    s->nfailed    = st->nfailed;
+    s->nsucceeded = st->nsucceeded;
+    s->stopped    = st->stopped;
+    s->nbatches   = st->batch.n;
+    s->nunstarted = st->nunstarted;
+}
+
+/*  Once every host of the batch has finished, ask opts->gate
+    whether to go on and start the next batch, twice as large up
+    to opts->npar.
+*/
+static void sched_batch_next(sched_state *st)
+{
+    sched_batch *b = &st->batch;
+    sched_stats s;
+
+    if ((st->nrunning > 0) || (st->nretry > 0) ||
+            ((b->n > 0) && (b->nlaunched < b->size) && st->more))
+        return;
+
+    if ((b->n > 0) && (b->nlaunched > 0)) {
+        debug_print(2, "batch %u of %u hosts finished", b->n, b->nlaunched);
+
+        if (st->more && (st->opts->gate != NULL)) {
+            sched_stats_get(st, &s);
+            if (!st->opts->gate(&s)) {
+                debug_print(1, "rollout stopped after batch %u", b->n);
+                st->stopped = true;
+                sched_stop(st);
+                return;
+            }
+        }
+    }
+
+    if (!st->more)
+        return;
+
+    b->size = b->n == 0 ? 1 : 2*b->size;
+    if (b->size > st->opts->npar)
+        b->size = st->opts->npar;
+    b->nlaunched = 0;
+    ++b->n;
+}
+
+/*  Pass the progress of the run to opts->status.
+*/
+static void sched_status(sched_state *st, const struct timespec *now)
+{
+    sched_stats s;
+
+    sched_stats_get(st, &s);
+    st->opts->status(&s);
+    st->ticked = *now;
+}
+
+/*  Run opts->command on every host returned by opts->next,
+    keeping up to opts->npar commands in flight at once.
+    All commands are spawned directly by the calling process
+    and their output pipes and exit statuses are monitored
+    from a single epoll loop.
+
+    Args:
+        opts:   scheduler configuration.
+
+    Returns:
+        counts of the hosts run.
+*/
+sched_stats sched_run(const sched_opts *opts)
+{
+    struct epoll_event ev[sched_nevents];
+    sigset_t mask, orig_mask;
+    sched_state st;
+    sched_stats stats;
+    unsigned i, nargs;
+    struct timespec now;
+    unsigned nrunning;
+    double ms;
+    int n, wait;
+    bool room;
+
+    st.opts = opts;
+    st.nrunning = st.nlaunched = 0;
+    st.ntimedout = st.nskipped = 0;
+    st.nfailed = st.nsucceeded = st.nunstarted = 0;
+    st.stopped = false;
+    st.retry = NULL;
+    st.nretry = st.retrymax = st.nheld = 0;
+    st.ratewait = 0;
+    st.more = true;
+    memset(&st.wave, 0, sizeof(st.wave));
+    memset(&st.batch, 0, sizeof(st.batch));
+
+    memset(&st.deadline, 0, sizeof(st.deadline));
+    if (sched_ts_set(&opts->deadline)) {
+        clock_gettime(CLOCK_MONOTONIC, &st.deadline);
+        sched_ts_add(&st.deadline, &st.deadline, &opts->deadline);
+    }
+
+    if ((st.jobs = malloc(sizeof(sched_job)*opts->npar)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+    for (i = 0; i < opts->npar; ++i)
+        sched_job_clear(&st.jobs[i]);
+
+    // argv followed by host, command if any and NULL
+    for (nargs = 0; opts->argv[nargs] != NULL; ++nargs);
+    if ((st.argv = malloc(sizeof(char*)*(nargs+3))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+    memcpy(st.argv, opts->argv, sizeof(char*)*nargs);
+    st.hostarg = nargs;
+    st.argv[nargs+1] = opts->command;
+    st.argv[nargs+2] = NULL;
+
+    // announce the connection, wait for the go signal and acknowledge it
+    if (opts->sync && (asprintf(&st.argv[nargs+1], "echo %s\nread _ || exit 255\necho %s\n%s",
+                                sched_ready_mark, sched_go_mark, opts->command) < 0))
+        debug_fail_errno("Failed to allocate memory");
+
+    // commands read from the terminal, never from our host list
+    if ((st.in = open("/dev/tty", O_RDONLY | O_CLOEXEC, 0x0)) < 0) {
+        debug_print(2, "no teletype, commands will read /dev/null");
+        if ((st.in = open("/dev/null", O_RDONLY | O_CLOEXEC, 0x0)) < 0)
+            debug_fail_errno("Failed to open /dev/null");
+    }
+
+    if ((st.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to create epoll instance");
+
+    // spread out the backoff of retries
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    srandom(now.tv_nsec ^ getpid());
+    st.ticked = now;
+
+    // block SIGCHLD so exits are only seen through the signalfd
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0)
+        debug_fail_errno("Failed to block SIGCHLD");
+
+    if ((st.sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to create signalfd");
+
+    ev[0].events = EPOLLIN;
+    ev[0].data.u64 = sched_sigtag;
+    if (epoll_ctl(st.epfd, EPOLL_CTL_ADD, st.sigfd, &ev[0]) < 0)
+        debug_fail_errno("Failed to add signalfd to epoll");
+
+    while (true) {
+        // enough hosts failed, or succeeded, to know the result
+        if (!st.stopped && sched_enough(&st)) {
+            debug_print(2, "ending run after %u failed and %u succeeded",
+                        st.nfailed, st.nsucceeded);
+            st.stopped = true;
+            sched_stop(&st);
+            if (opts->cancel || ((opts->until_success > 0) &&
+                                 (st.nsucceeded >= opts->until_success)))
+                sched_cancel(&st);
+        }
+
+        // launch nothing past the deadline, not even retries
+        if ((st.more || (st.nretry > 0)) && sched_ts_set(&st.deadline)) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (sched_overdue(&st, &now))
+                sched_stop(&st);
+        }
+
+        // fill every free slot, in sync mode only between waves
+        if (opts->rollout) {
+            sched_batch_next(&st);
+            sched_fill(&st);
+        }
+
+        else if (!opts->sync)
+            sched_fill(&st);
+
+        else if (st.nrunning == 0) {
+            // a wave that launched nothing is not a wave
+            if ((st.wave.nhosts > 0) || (st.wave.n == 0))
+                sched_wave_end(&st);
+            sched_fill(&st);
+        }
+
+        if ((st.nrunning == 0) && !st.more && (st.nretry == 0))
+            break;
+
+        // check timeouts only when some are set
+        nrunning = st.nrunning;
+        wait = (sched_ts_set(&opts->timeout) || sched_ts_set(&st.deadline) || st.stopped) ?
+            sched_expire(&st) : -1;
+
+        // slots freed by a timeout can be filled right away
+        if (st.nrunning < nrunning)
+            continue;
+
+        // wake for retries and the rate limit only when there is a slot for them
+        room = opts->sync ? (st.nrunning == 0) : (st.nrunning < sched_limit(&st));
+        if (room && (st.nretry > 0) &&
+                (((n = sched_retry_wait(&st)) < wait) || (wait < 0)))
+            wait = n;
+        if (room && (st.ratewait > 0) && ((st.ratewait < wait) || (wait < 0)))
+            wait = st.ratewait;
+
+        // refresh the status between events, never from the output path
+        if (opts->status != NULL) {
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if ((ms = sched_ms(&st.ticked, &now)) >= sched_tick) {
+                sched_status(&st, &now);
+                ms = 0.0;
+            }
+            if ((wait < 0) || (sched_tick - ms < wait))
+                wait = (int)(sched_tick - ms) + 1;
+        }
+
+        if ((n = epoll_wait(st.epfd, ev, sched_nevents, wait)) < 0) {
+            if (errno == EINTR)
+                continue;
+            debug_fail_errno("Failed to wait for events");
+        }
+
+        for (i = 0; i < (unsigned)n; ++i)
+            if (ev[i].data.u64 == sched_sigtag)
+                sched_reap(&st);
+            else
+                sched_read(&st, ev[i].data.u64);
+
+        // start the wave once every remaining host is connected
+        if (opts->sync && !st.wave.fired && (st.nrunning > 0) &&
+                (st.wave.nready == st.nrunning))
+            sched_fire(&st);
+    }
+
+    if (opts->status != NULL) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        sched_status(&st, &now);
+    }
+
+    debug_print(2, "launched %u hosts", st.nlaunched);
+
+    if (st.ntimedout > 0)
+        debug_print(1, "%u of %u hosts timed out", st.ntimedout, st.nlaunched);
+    if (st.nskipped > 0)
+        debug_print(1, "%s, %u hosts not started",
+                    st.stopped ? "run ended early" : "deadline reached", st.nskipped);
+
+    close(st.sigfd);
+    close(st.epfd);
+    close(st.in);
+
+    if (sigprocmask(SIG_SETMASK, &orig_mask, NULL) < 0)
+        debug_warn_errno("Failed to restore signal mask");
+
+    if (opts->sync)
+        free(st.argv[nargs+1]);
+    free(st.argv);
+    free(st.jobs);
+    free(st.retry);
+
+    sched_stats_get(&st, &stats);
+    return stats;
+}
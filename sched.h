@@ -0,0 +1,199 @@
+/*
+ *  Single process scheduler for running commands on many hosts.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef sched_h
+    #define sched_h
+
+    #include <limits.h>
+    #include <stdbool.h>
+    #include <stddef.h>
+    #include <sys/resource.h>
+    #include <sys/types.h>
+    #include <time.h>
+
+    #include "adapt.h"
+    #include "outbuf.h"
+    #include "ratelimit.h"
+
+    /* output streams captured from each command */
+    typedef enum {
+        sched_out,
+        sched_err,
+        sched_nstream
+    } sched_stream;
+
+    /* progress of a command through a synchronized wave */
+    typedef enum {
+        sched_connecting,   // waiting for the remote ready marker
+        sched_ready,        // connected and waiting to fire
+        sched_fired,        // go signal sent, waiting for acknowledgement
+        sched_started       // command is running
+    } sched_phase;
+
+    #define sched_linemax 32    // longest marker line
+    #define sched_grace   2     // seconds from SIGTERM to SIGKILL on timeout
+    #define sched_backoff 250   // milliseconds before the first retry, doubling after
+    #define sched_backoff_max 30000 // most milliseconds between retries
+    #define sched_tick    250   // milliseconds between calls to opts->status
+    #define sched_noindex UINT_MAX // index of jobs that are not hosts of the input, eg, relays
+
+    /* state of a command running on a single host */
+    typedef struct {
+        char        *host;                  // host name, NULL if slot is free
+        unsigned     index;                 // position of host in input
+        pid_t        pid;                   // process id of remote command
+        int          fd[sched_nstream];     // output pipes, -1 once closed
+        int          in;                    // input pipe in sync mode, -1 otherwise
+        sched_phase  phase;                 // progress through a synchronized wave
+        char         line[sched_linemax];   // partial marker line
+        size_t       linelen;               // number of bytes in line
+        struct timespec start;              // when the command was launched
+        struct timespec first;              // arrival of first output, zero if none
+        struct timespec end;                // when the command exited
+        size_t       nbytes[sched_nstream]; // bytes of output from each stream
+        struct rusage usage;                // resources used by the command
+        struct timespec expire;             // when the next stop signal is due, zero if never
+        unsigned     nkill;                 // stop signals sent so far
+        bool         timedout;              // true once the command ran out of time
+        bool         cancelled;             // true once stopped because the run ended early
+        unsigned     attempt;               // retries made so far
+        int          status;                // wait status of remote command
+        bool         reaped;                // true once command has exited
+        outbuf       out;                   // combined standard output and error
+        void        *priv;                  // owned by the callbacks, NULL when free
+    } sched_job;
+
+    /* progress of a run, passed to opts->status */
+    typedef struct {
+        unsigned nlaunched;     // hosts taken from opts->next
+        unsigned nrunning;      // commands in flight
+        unsigned nwaiting;      // hosts waiting to retry or held back by opts->rate
+        unsigned nfailed;       // hosts that failed or timed out
+        unsigned nsucceeded;    // hosts that exited with status zero
+        bool     stopped;       // true once the run ended early
+        unsigned nbatches;      // batches started in rollout mode
+        unsigned nunstarted;    // hosts in sync mode that ended before the go signal started them
+    } sched_stats;
+
+    /* scheduler configuration */
+    typedef struct {
+        unsigned          npar;     // maximum number of commands in flight
+        char            **argv;     // remote command and its arguments, NULL terminated
+        char             *command;  // command to execute remotely, may be NULL
+        ratelimit        *rate;     // if set, limits how fast hosts are launched
+        bool              sync;     // run in barrier synchronized waves
+        bool              rollout;  // run in batches of 1, 2, 4 and so on up to npar
+        adapt            *adapt;    // if set, varies the number in flight up to npar
+        struct timespec   timeout;  // longest each command may run, zero for no limit
+        struct timespec   deadline; // longest the whole run may take, zero for no limit
+        unsigned          retries;  // most retries of a host after transport failures
+        int               unreachable; // exit status of a transport failure, -1 if none
+        unsigned          max_failures;  // end the run once this many hosts fail, 0 for no limit
+        unsigned          until_success; // end the run once this many hosts succeed, 0 for no limit
+        bool              cancel;   // stop commands in flight when max_failures ends the run
+
+        /* return the next host to run on or NULL when done,
+           the scheduler keeps its own copy of the string */
+        char *(*next)();
+
+        /* if set, returns a descriptor read by the command for the
+           host at index as its standard input in place of the
+           terminal, which is closed once the command is launched,
+           not used in sync mode */
+        int (*input)(unsigned index);
+
+        /* if set, called with output as it arrives instead
+           of capturing it in j->out */
+        void (*output)(sched_job *j, sched_stream s, const char *data, size_t len);
+
+        /* called once the command on a host has exited and
+           all of its output has been captured, may take
+           ownership of j->host and j->out by setting host
+           to NULL and reinitializing out */
+        void (*done)(sched_job *j);
+
+        /* if set, called about every sched_tick milliseconds
+           while commands run and once more at the end */
+        void (*status)(const sched_stats *s);
+
+        /* if set in rollout mode, called once each batch has
+           finished and more hosts remain, returns false to end
+           the run instead of starting the next batch */
+        bool (*gate)(const sched_stats *s);
+    } sched_opts;
+
+    /*  Run opts->command on every host returned by opts->next,
+        keeping up to opts->npar commands in flight at once.
+        All commands are spawned directly by the calling process
+        and their output pipes and exit statuses are monitored
+        from a single epoll loop.
+
+        If opts->sync is set, hosts run in waves of opts->npar.
+        Every host in a wave first connects and waits, then the
+        command is started on all of them at once and the next
+        wave begins only after the whole wave has finished.  The
+        start skew of each wave is reported.
+
+        If opts->rollout is set, hosts run in batches that start
+        with one host and double up to opts->npar.  Each batch is
+        launched only once the last has finished, retries included,
+        and opts->gate allows it.
+
+        If opts->adapt is set, the number of commands in flight
+        follows its limit, which is revised as commands finish.
+
+        A command that runs past opts->timeout, or is still running
+        once opts->deadline has passed, is sent SIGTERM and then
+        SIGKILL if it has not exited after sched_grace seconds, and
+        j->timedout is set.  No hosts are launched past the deadline.
+
+        A command that exits with opts->unreachable is launched again
+        up to opts->retries times, after a jittered backoff that starts
+        at sched_backoff milliseconds and doubles with each retry.
+        Hosts waiting to retry do not count against opts->npar and
+        only the last attempt is passed to opts->done.
+
+        Once opts->max_failures hosts have failed or timed out, or
+        opts->until_success hosts have exited with status zero, no
+        more hosts are launched.  Commands in flight are then stopped
+        like timed out ones, with j->cancelled set instead, after
+        enough successes or if opts->cancel is set.
+
+        Args:
+            opts:   scheduler configuration.
+
+        Returns:
+            counts of the hosts run.
+    */
+    sched_stats sched_run(const sched_opts *opts);
+
+#endif
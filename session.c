@@ -0,0 +1,748 @@
+/*
+ *  Long lived shells on each host for running commands one after another.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "session.h"
+#include "adapt.h"
+#include "spawn.h"
+#include "debug.h"
+
+#define session_argmax 64     // most arguments before host and shell
+#define session_read   65536  // size of reads from sessions
+#define session_keep   64     // bytes held back that may start the end line
+#define session_tail   4096   // bytes held back before appending to output
+#define session_sigtag UINT32_MAX // epoll tag for the signalfd
+
+/* shell running on one host */
+typedef struct {
+    char     *host;     // host name
+    pid_t     pid;      // process id of the session, -1 when not running
+    int       in;       // commands to the shell, -1 once closed
+    int       out;      // output of the shell, -1 once closed
+    bool      busy;     // true until the current command finishes
+    bool      timedout; // true once killed for running too long
+    outbuf    buf;      // output of the current command
+    char      tail[session_tail]; // latest output, which may hold the end line
+    size_t    taillen;  // number of bytes in tail
+    struct timespec start; // when the current command was sent
+    struct timespec first; // arrival of its first output, zero if none
+    struct timespec expire; // when the next stop signal is due, zero if never
+    unsigned  nkill;    // stop signals sent so far
+    size_t    nbytes;   // bytes of output from the current command
+} session;
+
+/* shell whose pipes are closed, waiting to be reaped */
+typedef struct {
+    pid_t     pid;      // process id of the shell
+    unsigned  index;    // host finished once it is reaped, sched_noindex for none
+} session_exit;
+
+static session  *sessions = NULL;   // one per host
+static unsigned  session_n = 0;     // number of hosts
+static unsigned  session_max = 1;   // most sessions open at once
+static unsigned  session_nopen = 0; // sessions open now, or closed and not yet reaped
+static session_exit *session_exits = NULL; // shells closed and not yet reaped
+static unsigned  session_nexit = 0; // number of shells in session_exits
+static unsigned  session_exitmax = 0; // allocated length of session_exits
+static ratelimit *session_rate = NULL; // limits starting sessions, NULL for none
+static char     *session_argv[session_argmax+3] = {NULL};
+static unsigned  session_seq = 0;   // commands run so far
+static char      session_end[64];   // end line of the current command, up to the status
+
+/*  Start the shell on s.
+*/
+static bool session_start(session *s)
+{
+    int ip[2], op[2];
+    unsigned n;
+
+    if (pipe2(ip, O_CLOEXEC) < 0) {
+        debug_warn_errno("Failed to create pipe for %s", s->host);
+        return false;
+    }
+
+    if (pipe2(op, O_CLOEXEC) < 0) {
+        debug_warn_errno("Failed to create pipe for %s", s->host);
+        close(ip[0]);
+        close(ip[1]);
+        return false;
+    }
+
+    for (n = 0; session_argv[n] != NULL; ++n);
+    session_argv[n] = s->host;
+    session_argv[n+1] = session_shell;
+
+    s->pid = spawn_cmd(session_argv, ip[0], op[1], op[1]);
+    session_argv[n] = NULL;
+    session_argv[n+1] = NULL;
+
+    close(ip[0]);
+    close(op[1]);
+
+    if (s->pid < 0) {
+        debug_warn_errno("Failed to spawn %s for %s", session_argv[0], s->host);
+        close(ip[1]);
+        close(op[0]);
+        return false;
+    }
+
+    // a shell that stops reading must not stall the others
+    fcntl(ip[1], F_SETFL, O_NONBLOCK);
+
+    s->in  = ip[1];
+    s->out = op[0];
+    ++session_nopen;
+
+    debug_print(3, "session started on %s", s->host);
+
+    return true;
+}
+
+/*  Reap the shell with process id pid if it has ended, setting
+    status to its wait status.
+*/
+static bool session_reaped(pid_t pid, int *status)
+{
+    pid_t r;
+
+    while (((r = waitpid(pid, status, WNOHANG)) < 0) && (errno == EINTR));
+
+    // not ours to wait for, eg, reaped elsewhere
+    if (r < 0) {
+        debug_warn_errno("Failed to wait for session");
+        *status = 0;
+    }
+
+    return r != 0;
+}
+
+/*  Close the pipes of s, which ends its shell, and reap the shell
+    without waiting, returning true with its wait status if it
+    has ended already.  Otherwise session_reap does once it ends,
+    finishing host index with its status unless index is
+    sched_noindex.
+*/
+static bool session_stop(session *s, unsigned index, int *status)
+{
+    bool reaped = true;
+
+    if (s->in > -1)
+        close(s->in);
+    if (s->out > -1)
+        close(s->out);
+    s->in = s->out = -1;
+
+    if (s->pid > 0) {
+        if ((reaped = session_reaped(s->pid, status))) {
+            debug_print(3, "session ended on %s", s->host);
+            --session_nopen;
+        }
+
+        // still taking up room until it is reaped
+        else {
+            if (session_nexit == session_exitmax) {
+                session_exitmax = session_exitmax > 0 ? 2*session_exitmax : 16;
+                if ((session_exits = realloc(session_exits,
+                                             sizeof(session_exit)*session_exitmax)) == NULL)
+                    debug_fail_errno("Failed to allocate memory");
+            }
+            session_exits[session_nexit].pid = s->pid;
+            session_exits[session_nexit++].index = index;
+        }
+    }
+    s->pid = -1;
+
+    return reaped;
+}
+
+/*  Write all of data to the shell of s, closing its input if
+    the shell has gone or will not take it.
+*/
+static void session_send(session *s, const char *data, size_t len)
+{
+    while ((len > 0) && (s->in > -1)) {
+        ssize_t w = write(s->in, data, len);
+
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+
+            if (errno == EAGAIN)
+                debug_warn("Session on %s is not reading commands", s->host);
+
+            // the shell sees the end of its input and exits
+            close(s->in);
+            s->in = -1;
+            break;
+        }
+
+        data += w;
+        len  -= w;
+    }
+}
+
+/*  Quote command for the shell, followed by the line marking its
+    end, into a new string of size bytes.
+*/
+static char *session_script(const char *command, size_t *size)
+{
+    char *script;
+    FILE *f;
+
+    if ((f = open_memstream(&script, size)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    // eval keeps a broken command from swallowing the end line and
+    // command keeps its syntax errors from ending the shell, while
+    // commands must not read the rest of the session
+    fputs("command eval '", f);
+    for (; *command != '\0'; ++command)
+        if (*command == '\'')
+            fputs("'\\''", f);
+        else
+            fputc(*command, f);
+    fprintf(f, "' </dev/null\nprintf '%s %%d\\n' \"$?\"\n", session_end);
+
+    if (fclose(f) != 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    return script;
+}
+
+/*  Look for the end line at the end of the output held back by
+    s, removing it and setting status if found.
+*/
+static bool session_ended(session *s, int *status)
+{
+    size_t len = strlen(session_end);
+    char *p, *found = NULL, *nl, code[16];
+    int n;
+
+    if ((s->taillen == 0) || (s->tail[s->taillen-1] != '\n'))
+        return false;
+
+    // the end line is the last line, though the command may not end its own
+    for (p = s->tail; (p = memmem(p, s->tail + s->taillen - p, session_end, len)) != NULL; ++p)
+        found = p;
+
+    if (found == NULL)
+        return false;
+
+    nl = memchr(found, '\n', s->tail + s->taillen - found);
+    if (nl != s->tail + s->taillen - 1)
+        return false;
+
+    // the tail is not terminated, parse a copy of the status alone
+    if ((size_t)(nl - (found + len)) >= sizeof(code))
+        return false;
+    memcpy(code, found + len, nl - (found + len));
+    code[nl - (found + len)] = '\0';
+
+    if (sscanf(code, " %d", &n) != 1)
+        return false;
+
+    s->taillen = found - s->tail;
+    *status = W_EXITCODE(n & 0xff, 0);
+
+    return true;
+}
+
+/*  Add data read from the shell of s to the output of its
+    command, holding back enough to find the end line.
+*/
+static void session_add(session *s, const char *data, size_t len)
+{
+    if ((s->nbytes == 0) && (len > 0))
+        clock_gettime(CLOCK_MONOTONIC, &s->first);
+    s->nbytes += len;
+
+    while (len > 0) {
+        size_t n = session_tail - s->taillen;
+        if (n > len)
+            n = len;
+
+        memcpy(s->tail + s->taillen, data, n);
+        s->taillen += n;
+        data += n;
+        len  -= n;
+
+        if (s->taillen == session_tail) {
+            size_t out = session_tail - session_keep;
+            outbuf_append(&s->buf, s->tail, out);
+            memmove(s->tail, s->tail + out, session_keep);
+            s->taillen = session_keep;
+        }
+    }
+}
+
+/*  Hand the current command of s to done with status.
+*/
+static void session_finish(session *s, unsigned index, int status,
+                           void (*done)(sched_job *j))
+{
+    sched_job j;
+
+    memset(&j, 0, sizeof(j));
+
+    outbuf_append(&s->buf, s->tail, s->taillen);
+    s->taillen = 0;
+
+    if ((j.host = strdup(s->host)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    j.index  = index;
+    j.pid    = -1;
+    j.in     = -1;
+    j.fd[sched_out] = j.fd[sched_err] = -1;
+    j.start  = s->start;
+    j.first  = s->first;
+    j.nbytes[sched_out] = s->nbytes;
+    j.status = status;
+    j.reaped = true;
+    j.timedout = s->timedout;
+    j.out    = s->buf;
+    clock_gettime(CLOCK_MONOTONIC, &j.end);
+
+    s->busy = false;
+    s->timedout = false;
+    outbuf_init(&s->buf);
+
+    done(&j);
+
+    free(j.host);
+    outbuf_free(&j.out);
+}
+
+/*  Reap every closed shell that has ended, finishing the host
+    waiting for it with its wait status and counting the host in
+    nfailed if it failed.  Returns the number of hosts finished.
+*/
+static unsigned session_reap(void (*done)(sched_job *j), unsigned *nfailed)
+{
+    unsigned i = 0, nfinished = 0;
+    int status;
+
+    while (i < session_nexit) {
+        session_exit e = session_exits[i];
+
+        if (!session_reaped(e.pid, &status)) {
+            ++i;
+            continue;
+        }
+
+        session_exits[i] = session_exits[--session_nexit];
+        --session_nopen;
+
+        if (e.index == sched_noindex)
+            continue;
+
+        debug_print(3, "session ended on %s", sessions[e.index].host);
+        if (status != 0)
+            ++*nfailed;
+        session_finish(&sessions[e.index], e.index, status, done);
+        ++nfinished;
+    }
+
+    return nfinished;
+}
+
+/*  Prepare a session on every host returned by next.  Sessions
+    are started by the first command and again only after they
+    end, running argv followed by the host and session_shell.
+
+    Args:
+        argv:   remote command and its arguments, NULL terminated.
+
+        next:   returns the next host or NULL when done.
+
+        max:    most sessions open at once, lowered to what the open
+                file limit allows.  With more hosts than that, idle
+                sessions are closed to make room for the rest.
+
+        rate:   limits starting sessions, NULL for no limit.
+*/
+void session_init(char **argv, char *(*next)(), unsigned max, ratelimit *rate)
+{
+    unsigned size = 0, ceiling = adapt_ceiling(2), i;
+    char *host;
+
+    for (i = 0; argv[i] != NULL; ++i) {
+        if (i == session_argmax)
+            debug_fail("Too many arguments for sessions");
+        session_argv[i] = argv[i];
+    }
+    session_argv[i] = NULL;
+
+    session_max  = max < 1 ? 1 : max > ceiling ? ceiling : max;
+    session_rate = rate;
+    session_nopen = 0;
+
+    session_n = 0;
+    while ((host = next()) != NULL) {
+        session *s;
+
+        if (session_n == size) {
+            size = size > 0 ? 2*size : 64;
+            if ((sessions = realloc(sessions, size*sizeof(session))) == NULL)
+                debug_fail_errno("Failed to allocate memory");
+        }
+
+        s = &sessions[session_n++];
+        memset(s, 0, sizeof(*s));
+        if ((s->host = strdup(host)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        s->pid = -1;
+        s->in = s->out = -1;
+        outbuf_init(&s->buf);
+    }
+
+    debug_print(2, "up to %u of %u sessions open at once",
+                session_max < session_n ? session_max : session_n, session_n);
+}
+
+/*  Send script to the session of host index, starting it first
+    if needed, and watch its output.  False if the session could
+    not be started.
+*/
+static bool session_begin(unsigned index, int ep, const char *script, size_t size,
+                          const struct timespec *now, const struct timespec *timeout)
+{
+    session *s = &sessions[index];
+    struct epoll_event ev = {.events = EPOLLIN, .data.u32 = index};
+
+    s->busy  = true;
+    s->start = *now;
+    s->first.tv_sec = s->first.tv_nsec = 0;
+    s->expire.tv_sec = s->expire.tv_nsec = 0;
+    s->nkill  = 0;
+    s->nbytes = 0;
+
+    if (s->pid < 0) {
+        if (session_rate != NULL)
+            ratelimit_take(session_rate, s->host);
+        if (!session_start(s))
+            return false;
+    }
+
+    if ((timeout->tv_sec != 0) || (timeout->tv_nsec != 0)) {
+        s->expire.tv_sec  = now->tv_sec + timeout->tv_sec;
+        s->expire.tv_nsec = now->tv_nsec + timeout->tv_nsec;
+        if (s->expire.tv_nsec >= 1000000000L) {
+            s->expire.tv_nsec -= 1000000000L;
+            ++s->expire.tv_sec;
+        }
+    }
+
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, s->out, &ev) < 0)
+        debug_fail_errno("Failed to watch session");
+
+    session_send(s, script, size);
+
+    return true;
+}
+
+/*  Stop the shell of s, which ran out of time, with SIGTERM first
+    and SIGKILL once sched_grace seconds have passed, as the
+    scheduler does.  True once its output is no longer worth
+    waiting for, eg, held open by a background process.
+*/
+static bool session_kill(session *s, const struct timespec *now)
+{
+    if (!s->timedout) {
+        debug_print(2, "%s timed out", s->host);
+        s->timedout = true;
+    }
+
+    if (s->nkill == 2)
+        return true;
+
+    if (kill(s->pid, s->nkill == 0 ? SIGTERM : SIGKILL) < 0)
+        debug_warn_errno("Failed to stop session on %s", s->host);
+
+    s->expire.tv_sec  = now->tv_sec + sched_grace;
+    s->expire.tv_nsec = now->tv_nsec;
+    ++s->nkill;
+
+    return false;
+}
+
+/*  Run command on every host through its session, starting any
+    session that is not running.  The end of each output is
+    marked by a line holding session_mark and the exit status
+    of the command, which is removed.  A host whose session ends
+    or that runs out of time is finished with the wait status of
+    its shell and the session is started again for the next
+    command.
+
+    Hosts with an open session go first.  The rest wait for room
+    under the most sessions open at once and for the rate limit.
+
+    Args:
+        command:    shell command to run.
+
+        timeout:    longest the command may run on each host, zero
+                    for no limit.
+
+        done:       called with each host as its command finishes,
+                    matching sched_opts.done.
+
+    Returns:
+        number of hosts on which the command failed.
+*/
+unsigned session_run(const char *command, struct timespec timeout,
+                     void (*done)(sched_job *j))
+{
+    struct epoll_event evs[64], ev = {.events = EPOLLIN, .data.u32 = session_sigtag};
+    unsigned nbusy = 0, nfailed = 0, next = 0, n = 0, i;
+    sigset_t mask, orig_mask;
+    unsigned *order;
+    struct timespec now;
+    char *buff, *script;
+    size_t size;
+    int ep, sigfd;
+
+    // a new end line each time, so a late one is never taken for ours
+    snprintf(session_end, sizeof(session_end), "%s %ld.%u",
+             session_mark, (long)getpid(), ++session_seq);
+    script = session_script(command, &size);
+
+    if ((ep = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to create epoll instance");
+
+    // closed shells are reaped as they end, seen through the signalfd
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0)
+        debug_fail_errno("Failed to block SIGCHLD");
+    if ((sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to create signalfd");
+    if (epoll_ctl(ep, EPOLL_CTL_ADD, sigfd, &ev) < 0)
+        debug_fail_errno("Failed to add signalfd to epoll");
+
+    // and those that ended since the last command
+    session_reap(NULL, &nfailed);
+
+    if (((buff = malloc(session_read)) == NULL) ||
+            ((order = malloc(sizeof(unsigned)*(session_n+1))) == NULL))
+        debug_fail_errno("Failed to allocate memory");
+
+    // open sessions never wait for room
+    for (i = 0; i < session_n; ++i)
+        if (sessions[i].pid > 0)
+            order[n++] = i;
+    for (i = 0; i < session_n; ++i)
+        if (sessions[i].pid < 0)
+            order[n++] = i;
+
+    while ((next < session_n) || (nbusy > 0)) {
+        double wait = -1.0, ms;
+        int nev, k;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        while (next < session_n) {
+            session *s = &sessions[order[next]];
+
+            if (s->pid < 0) {
+                if (session_nopen >= session_max)
+                    break;
+                if ((session_rate != NULL) &&
+                        ((ms = ratelimit_wait(session_rate, s->host)) > 0.0)) {
+                    wait = ms;
+                    break;
+                }
+            }
+
+            if (session_begin(order[next], ep, script, size, &now, &timeout))
+                ++nbusy;
+            else {
+                session_finish(s, order[next], W_EXITCODE(127, 0), done);
+                ++nfailed;
+            }
+            ++next;
+        }
+
+        if (nbusy == 0) {
+            int status;
+
+            // idle sessions give way to the hosts still waiting
+            if (wait < 0.0)
+                for (i = 0; i < session_n; ++i)
+                    if (sessions[i].pid > 0)
+                        session_stop(&sessions[i], sched_noindex, &status);
+
+            // and wait for the rate limit, or for them to end
+            if (session_nexit == 0) {
+                if (wait > 0.0)
+                    usleep((useconds_t)(wait*1000.0));
+                continue;
+            }
+        }
+
+        // stop the commands that ran out of time
+        for (i = 0; i < session_n; ++i) {
+            session *s = &sessions[i];
+
+            if (!s->busy || (s->pid < 0) || ((s->expire.tv_sec == 0) && (s->expire.tv_nsec == 0)))
+                continue;
+
+            ms = (s->expire.tv_sec - now.tv_sec)*1000.0 + (s->expire.tv_nsec - now.tv_nsec)/1000000.0;
+            if ((ms <= 0.0) && session_kill(s, &now)) {
+                int status;
+
+                // killed, though it may not be reaped yet
+                epoll_ctl(ep, EPOLL_CTL_DEL, s->out, NULL);
+                if (!session_stop(s, sched_noindex, &status))
+                    status = SIGKILL;
+                session_finish(s, i, status, done);
+                ++nfailed;
+                --nbusy;
+                continue;
+            }
+            if (ms <= 0.0)
+                ms = sched_grace*1000.0;
+
+            if ((wait < 0.0) || (ms < wait))
+                wait = ms;
+        }
+
+        if ((nbusy == 0) && (session_nexit == 0))
+            continue;
+
+        if ((nev = epoll_wait(ep, evs, sizeof(evs)/sizeof(evs[0]),
+                              wait < 0.0 ? -1 : (int)wait + 1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            debug_fail_errno("Failed to wait for sessions");
+        }
+
+        for (k = 0; k < nev; ++k) {
+            struct signalfd_siginfo si;
+            session *s;
+            int status;
+            ssize_t r;
+
+            // drain pending notifications, several exits may share one
+            if (evs[k].data.u32 == session_sigtag) {
+                while (read(sigfd, &si, sizeof(si)) == sizeof(si));
+                nbusy -= session_reap(done, &nfailed);
+                continue;
+            }
+
+            if (!(s = &sessions[evs[k].data.u32])->busy)
+                continue;
+
+            if ((r = read(s->out, buff, session_read)) < 0) {
+                if ((errno == EINTR) || (errno == EAGAIN))
+                    continue;
+                r = 0;
+            }
+
+            if (r > 0) {
+                session_add(s, buff, r);
+                if (!session_ended(s, &status))
+                    continue;
+                epoll_ctl(ep, EPOLL_CTL_DEL, s->out, NULL);
+            }
+
+            // the shell is gone, report how it went once it is reaped
+            else {
+                epoll_ctl(ep, EPOLL_CTL_DEL, s->out, NULL);
+                if (!s->timedout)
+                    debug_warn("Session on %s ended", s->host);
+                if (!session_stop(s, evs[k].data.u32, &status))
+                    continue;
+            }
+
+            if (status != 0)
+                ++nfailed;
+
+            session_finish(s, evs[k].data.u32, status, done);
+            --nbusy;
+
+            // make room for a host still waiting for a session
+            if ((next < session_n) && (sessions[order[next]].pid < 0) &&
+                    (session_nopen >= session_max))
+                session_stop(s, sched_noindex, &status);
+        }
+    }
+
+    close(sigfd);
+    if (sigprocmask(SIG_SETMASK, &orig_mask, NULL) < 0)
+        debug_warn_errno("Failed to restore signal mask");
+
+    free(order);
+    free(script);
+    free(buff);
+    close(ep);
+
+    return nfailed;
+}
+
+/*  End every session and free them.
+*/
+void session_free()
+{
+    unsigned i;
+    int status;
+
+    // closing its input ends each shell, all of them at once
+    for (i = 0; i < session_n; ++i) {
+        session_stop(&sessions[i], sched_noindex, &status);
+        free(sessions[i].host);
+        outbuf_free(&sessions[i].buf);
+    }
+
+    for (i = 0; i < session_nexit; ++i)
+        while ((waitpid(session_exits[i].pid, &status, 0) < 0) && (errno == EINTR));
+
+    free(sessions);
+    free(session_exits);
+    sessions = NULL;
+    session_exits = NULL;
+    session_n = session_nexit = session_exitmax = 0;
+}
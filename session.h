@@ -0,0 +1,94 @@
+/*
+ *  Long lived shells on each host for running commands one after another.
+ */
+
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef session_h
+    #define session_h
+
+    #include <time.h>
+
+    #include "sched.h"
+
+    /* start of the line ending the output of each command */
+    #define session_mark "@@sshall-end@@"
+
+    /* command run on each host to start its shell */
+    #define session_shell "exec sh 2>&1"
+
+    /*  Prepare a session on every host returned by next.  Sessions
+        are started by the first command and again only after they
+        end, running argv followed by the host and session_shell.
+
+        Args:
+            argv:   remote command and its arguments, NULL terminated.
+
+            next:   returns the next host or NULL when done.
+
+            max:    most sessions open at once, lowered to what the open
+                    file limit allows.  With more hosts than that, idle
+                    sessions are closed to make room for the rest.
+
+            rate:   limits starting sessions, NULL for no limit.
+    */
+    void session_init(char **argv, char *(*next)(), unsigned max, ratelimit *rate);
+
+    /*  Run command on every host through its session, starting any
+        session that is not running.  The end of each output is
+        marked by a line holding session_mark and the exit status
+        of the command, which is removed.  A host whose session ends
+        or that runs out of time is finished with the wait status of
+        its shell and the session is started again for the next
+        command.
+
+        Hosts with an open session go first.  The rest wait for room
+        under the most sessions open at once and for the rate limit.
+
+        Args:
+            command:    shell command to run.
+
+            timeout:    longest the command may run on each host, zero
+                        for no limit.
+
+            done:       called with each host as its command finishes,
+                        matching sched_opts.done.
+
+        Returns:
+            number of hosts on which the command failed.
+    */
+    unsigned session_run(const char *command, struct timespec timeout,
+                         void (*done)(sched_job *j));
+
+    /*  End every session and free them.
+    */
+    void session_free();
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ *  Spawn child processes with redirected standard streams.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "spawn.h"
+#include "debug.h"
+
+/*  Spawn the command in arg with its standard input, output and
+    error streams connected to in, out and err.  The signal mask
+    of the child is cleared and SIGPIPE is restored to its default
+    action before exec.
+
+    Args:
+        arg:    NULL terminated argument vector, arg[0] is
+                searched for in PATH.
+
+        in:     file descriptor to use as standard input.
+
+        out:    file descriptor to use as standard output.
+
+        err:    file descriptor to use as standard error.
+
+    Returns:
+        process id of the child or -1 with errno set if the
+        command could not be spawned.
+*/
+pid_t spawn_cmd(char *const arg[], int in, int out, int err)
+{
+    posix_spawn_file_actions_t fa;
+    posix_spawnattr_t attr;
+    sigset_t mask, dflt;
+    pid_t id;
+    int rc;
+
+    // the caller may be blocking signals, eg, SIGCHLD for a signalfd,
+    // or ignoring SIGPIPE, neither should leak into the command
+    sigemptyset(&mask);
+    sigemptyset(&dflt);
+    sigaddset(&dflt, SIGPIPE);
+
+    if (((rc = posix_spawnattr_init(&attr)) != 0) ||
+        ((rc = posix_spawn_file_actions_init(&fa)) != 0)) {
+        errno = rc;
+        debug_fail_errno("Failed to initialize spawn attributes");
+    }
+
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+    posix_spawnattr_setsigmask(&attr, &mask);
+    posix_spawnattr_setsigdefault(&attr, &dflt);
+
+    posix_spawn_file_actions_adddup2(&fa, in,  STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, out, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&fa, err, STDERR_FILENO);
+
+    // the child shares our memory until exec, so the cost of a
+    // launch does not grow with the size of the parent
+    if ((rc = posix_spawnp(&id, arg[0], &fa, &attr, arg, environ)) != 0) {
+        errno = rc;
+        id = -1;
+    }
+
+    posix_spawn_file_actions_destroy(&fa);
+    posix_spawnattr_destroy(&attr);
+
+    return id;
+}
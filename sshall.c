@@ -37,7 +37,9 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <limits.h>
 #include <math.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -49,26 +51,62 @@
 #include <unistd.h>
 
 #include "debug.h"
+#include "collect.h"
+#include "ctlpool.h"
 #include "colorset.h"
-#include "ioredir.h"
+#include "hostlist.h"
+#include "sched.h"
+#include "spawn.h"
+#include "stream.h"
+#include "transport.h"
+#include "adapt.h"
+#include "progress.h"
+#include "report.h"
+#include "group.h"
+#include "tree.h"
+#include "payload.h"
+#include "session.h"
+#include "ratelimit.h"
+#include "probe.h"
 
 #ifdef RSH
-    #define rcmd "rsh"
-    #define cmd_args "-n" // XXX idfah
+    #define transport_default "rsh"
 #else
-    #define rcmd "ssh"
-    #define cmd_args "-o ConnectTimeout=2", "-o StrictHostkeyChecking=no", "-o ForwardX11=no"
+    #define transport_default "ssh"
 #endif
 
-#define rbuff_isize    3     // size of host read buffer
 #define npar_default   10    // default number of commands to run in parallel
-
-// default arguments to rcmd, should be able to configure in environment var or something XXX - idfah
-/*char *cmd_args[] =
-        {"-o ConnectTimeout=2",
-         "-o StrictHostkeyChecking=no",
-         "-o ForwardX11=no"};
-int ncmd_args = 3;*/
+#define rcmd_argmax    32    // most arguments before host and command
+
+// options without a short form
+enum {
+    opt_spill_host = 256,   // per host bytes before output spills to disk
+    opt_spill_total,        // total bytes before output spills to disk
+    opt_reorder,            // hosts held back to print in input order
+    opt_unique,             // drop repeated hosts
+    opt_pool,               // reuse pooled ssh master connections
+    opt_pool_status,        // report pooled master connections
+    opt_pool_stop,          // stop pooled master connections
+    opt_deadline,           // longest the whole run may take
+    opt_progress,           // show a status line while running
+    opt_report,             // write a record of each host to a file
+    opt_fanout,             // number of relays to split hosts among
+    opt_depth,              // levels of relays
+    opt_relay_cmd,          // command that runs sshall on relays
+    opt_frame,              // report each host as a record, used by relays
+    opt_rate,               // launches per second
+    opt_group_rate,         // launches per second to each group of hosts
+    opt_max_failures,       // end the run once this many hosts fail
+    opt_until_success,      // end the run once this many hosts succeed
+    opt_cancel,             // stop commands in flight when the run ends on failures
+    opt_rollout,            // run in batches doubling from one host
+    opt_max_fail_rate,      // percent of a batch that may fail
+    opt_gate,               // local command that must pass between batches
+    opt_probe,              // check hosts are reachable before running
+    opt_probe_timeout,      // longest to wait for each probe
+    opt_probe_ttl,          // seconds dead hosts stay in the cache
+    opt_probe_cache         // file of dead hosts
+};
 
 // when to display colors
 typedef enum {
@@ -88,19 +126,61 @@ typedef enum {
 #define colfg_err  37       // error foregroud color
 #define colbg_err  41       // error background color
 
+#define timedout_mark  "*** timed out ***\n" // printed after output of hosts that timed out
+#define cancelled_mark "*** cancelled ***\n" // printed after output of hosts stopped when the run ended
 
-//
-const int lockfile_flags = O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC;
 
 char     *prog_name;       // name of this program
 char     *command = NULL;  // command to execute remotely
-int       input   = -1;    // input file descriptor
+int       input   = -1;    // host list file descriptor
+hostlist  hosts;           // hosts to run on
+bool      unique  = false; // drop repeated hosts
+char     *pool    = NULL;  // ControlPersist time if using the connection pool
+char     *pool_op = NULL;  // ssh -O control command to send to pooled masters
+char     *trans_name = transport_default; // name of transport to use
+char     *trans_args = NULL; // arguments replacing the transport defaults
+const transport *trans = NULL; // transport used to reach hosts
+char     *rcmd_argv[rcmd_argmax+1] = {NULL}; // remote command and arguments
 unsigned  npar    = 0;     // number of commands to run in parallel
-bool      interac = false; //
+bool      adaptive = false; // vary the number in parallel, npar is the ceiling
+bool      interac = false; // run commands read from standard input through sessions
 bool      async   = true; //
+bool      live    = false; // stream output line by line as it arrives
+bool      grouped = false; // print identical outputs once with their hosts
+bool      broadcast = false; // give our standard input to every command
+unsigned  fanout  = 0;     // relays to split hosts among, 0 to reach hosts directly
+unsigned  depth   = 1;     // levels of relays
+char     *relay_cmd = "sshall"; // command that runs sshall on relays
+bool      frame   = false; // send records back to a parent instead of printing
+bool      progress = false; // show a status line on a terminal
+char     *report  = NULL;  // file to write a record of each host to
+void    (*par_done)(sched_job *j) = NULL; // prints a finished host
 color     colstat = color_auto; // weather or not to use color
 bool      usecol  = false;
-struct timespec delay = {.tv_sec=0, .tv_nsec=0}; // delay between hosts
+double    rate    = 0.0;   // launches per second, 0 for no limit
+double    burst   = 1.0;   // launches at once before rate applies
+double    group_rate  = 0.0; // launches per second to each group of hosts, 0 for no limit
+double    group_burst = 1.0; // launches at once to each group of hosts
+ratelimit limiter;         // applies rate and group_rate
+ratelimit *launch_rate = NULL; // limiter if any rate is set
+struct timespec timeout  = {.tv_sec=0, .tv_nsec=0}; // longest each host may run
+struct timespec deadline = {.tv_sec=0, .tv_nsec=0}; // longest the whole run may take
+unsigned  retries = 0;     // retries of hosts that could not be reached
+unsigned  max_failures  = 0; // end the run once this many hosts fail, 0 for no limit
+unsigned  until_success = 0; // end the run once this many hosts succeed, 0 for no limit
+bool      cancel  = false; // stop commands in flight when the run ends on failures
+int       exit_status = EXIT_SUCCESS; // returned once done
+bool      rollout = false; // run in batches of 1, 2, 4 and so on up to npar
+double    max_fail_rate = 0.0; // percent of a batch that may fail before a rollout stops
+char     *gate    = NULL;  // local command that must pass before each batch
+char     *probe_port = NULL; // port to probe hosts on before running, NULL for no probe
+struct timespec probe_timeout = {.tv_sec=2, .tv_nsec=0}; // longest to wait for each probe
+long      probe_ttl   = probe_ttl_default; // seconds dead hosts stay in the cache, 0 for none
+char     *probe_cache = NULL; // file of dead hosts, NULL for the default
+collect_order order  = collect_completion;    // order to print hosts in
+unsigned  reorder    = collect_window_default; // hosts held back for ordering
+size_t    spill_host  = outbuf_host_default;  // output kept in memory per host
+size_t    spill_total = outbuf_total_default; // output kept in memory overall
 
 /*
  *  Function bodies
@@ -111,18 +191,129 @@ struct timespec delay = {.tv_sec=0, .tv_nsec=0}; // delay between hosts
 void print_usage()
 {
     printf("Usage: %s [OPTIONS] command\n", prog_name);
-    printf("    -c, --color\n"
+    printf("    -a, --args\n"
+            "    -b, --broadcast     standard input is read in full first, spooled\n"
+            "                        to $TMPDIR unless it is a file, then replayed\n"
+            "                        to every command; $TMPDIR needs room for all\n"
+            "                        of it\n"
+            "    -c, --color\n"
             "    -d, --delay\n"
             "    -f, --file\n"
+            "    -g, --group\n"
             "    -h, --help\n"
+            "    -H, --hosts\n"
             "    -h, --version\n"
             "    -i, --interactive\n"
+            "    -l, --live\n"
+            "    -o, --order\n"
             "    -p, --parallel\n"
             "    -q, --quiet\n"
+            "    -r, --retries\n"
+            "    -s, --sync\n"
+            "    -t, --transport\n"
+            "    -T, --timeout\n"
+            "        --deadline\n"
+            "        --progress\n"
+            "        --report\n"
+            "        --rate\n"
+            "        --group-rate\n"
+            "        --max-failures\n"
+            "        --until-success\n"
+            "        --cancel\n"
+            "        --rollout\n"
+            "        --max-fail-rate\n"
+            "        --gate\n"
+            "        --probe\n"
+            "        --probe-timeout\n"
+            "        --probe-ttl\n"
+            "        --probe-cache\n"
+            "        --fanout\n"
+            "        --depth\n"
+            "        --relay-cmd\n"
+            "        --spill-host\n"
+            "        --spill-total\n"
+            "        --reorder\n"
+            "        --unique\n"
+            "        --pool\n"
+            "        --pool-status\n"
+            "        --pool-stop\n"
             "    -u, --user\n"
             "    -v, --verbose\n");
 }
 
+/*  Parse a byte count with an optional k, m or g suffix.
+    */
+size_t parse_size(const char *str)
+{
+    char *end;
+    size_t size;
+
+    errno = 0;
+    size = (size_t)strtoull(str, &end, 10);
+    if ((errno != 0) || (end == str))
+        debug_fail("Invalid size %s", str);
+
+    switch (tolower(*end)) {
+        case 'g': size <<= 10;    // fall through
+        case 'm': size <<= 10;    // fall through
+        case 'k': size <<= 10;
+                  ++end;            // fall through
+        case '\0': break;
+        default:
+            debug_fail("Invalid size %s", str);
+    }
+
+    if (*end != '\0')
+        debug_fail("Invalid size %s", str);
+
+    return size;
+}
+
+/*  Parse a rate of launches per second with an optional burst,
+    as rate[:burst], eg, 50:10.
+*/
+void parse_rate(const char *str, double *rate, double *burst)
+{
+    char *end;
+
+    errno = 0;
+    *rate = strtod(str, &end);
+    if ((errno != 0) || (end == str) || !(*rate > 0.0) || isinf(*rate))
+        debug_fail("Invalid rate %s", str);
+
+    *burst = 1.0;
+    if (*end == ':') {
+        const char *b = end + 1;
+
+        *burst = strtod(b, &end);
+        if ((errno != 0) || (end == b) || !(*burst >= 1.0) || isinf(*burst))
+            debug_fail("Invalid burst in %s", str);
+    }
+
+    if (*end != '\0')
+        debug_fail("Invalid rate %s", str);
+}
+
+/*  Parse a positive number of seconds, possibly fractional.
+    */
+struct timespec parse_time(const char *str)
+{
+    struct timespec ts;
+    double secs;
+    char *end;
+
+    errno = 0;
+    secs = strtod(str, &end);
+    if ((errno != 0) || (end == str) || (*end != '\0') ||
+            !(secs > 0.0) || isinf(secs))
+        debug_fail("Invalid time %s", str);
+
+    ts.tv_sec  = (time_t)secs;
+    ts.tv_nsec = (long)((secs-floor(secs))*1000000000.0);
+
+    return ts;
+}
+
 /*  Parse command line arguments and
     setup variables accordingly.
     */
@@ -132,22 +323,67 @@ void parse_args(int narg, char *arg[])
 
     // long options
     const struct option longopts[] = {
+        { "args",        required_argument, NULL, 'a' },
+        { "broadcast",   no_argument,       NULL, 'b' },
         { "color",       optional_argument, NULL, 'c' },
         { "delay",       required_argument, NULL, 'd' },
         { "file",        required_argument, NULL, 'f' },
+        { "group",       no_argument,       NULL, 'g' },
         { "help",        no_argument,       NULL, 'h' },
+        { "hosts",       required_argument, NULL, 'H' },
         { "interactive", no_argument,       NULL, 'i' },
+        { "live",        no_argument,       NULL, 'l' },
+        { "order",       required_argument, NULL, 'o' },
         { "parallel",    optional_argument, NULL, 'p' },
         { "quiet",       no_argument,       NULL, 'q' },
-        { "verbose",     no_argument,       NULL, 'v' }
+        { "retries",     required_argument, NULL, 'r' },
+        { "sync",        no_argument,       NULL, 's' },
+        { "transport",   required_argument, NULL, 't' },
+        { "timeout",     required_argument, NULL, 'T' },
+        { "deadline",    required_argument, NULL, opt_deadline },
+        { "progress",    no_argument,       NULL, opt_progress },
+        { "report",      required_argument, NULL, opt_report },
+        { "rate",        required_argument, NULL, opt_rate },
+        { "group-rate",  required_argument, NULL, opt_group_rate },
+        { "max-failures", required_argument, NULL, opt_max_failures },
+        { "until-success", required_argument, NULL, opt_until_success },
+        { "cancel",      no_argument,       NULL, opt_cancel },
+        { "rollout",     no_argument,       NULL, opt_rollout },
+        { "max-fail-rate", required_argument, NULL, opt_max_fail_rate },
+        { "gate",        required_argument, NULL, opt_gate },
+        { "probe",       optional_argument, NULL, opt_probe },
+        { "probe-timeout", required_argument, NULL, opt_probe_timeout },
+        { "probe-ttl",   required_argument, NULL, opt_probe_ttl },
+        { "probe-cache", required_argument, NULL, opt_probe_cache },
+        { "fanout",      required_argument, NULL, opt_fanout },
+        { "depth",       required_argument, NULL, opt_depth },
+        { "relay-cmd",   required_argument, NULL, opt_relay_cmd },
+        { "frame",       no_argument,       NULL, opt_frame },
+        { "spill-host",  required_argument, NULL, opt_spill_host },
+        { "spill-total", required_argument, NULL, opt_spill_total },
+        { "reorder",     required_argument, NULL, opt_reorder },
+        { "unique",      no_argument,       NULL, opt_unique },
+        { "pool",        optional_argument, NULL, opt_pool },
+        { "pool-status", no_argument,       NULL, opt_pool_status },
+        { "pool-stop",   no_argument,       NULL, opt_pool_stop },
+        { "verbose",     no_argument,       NULL, 'v' },
+        { NULL,          0,                 NULL, 0 }
     };
 
     // option string 
-    const char optstring[] = "+c::d:f:hip::qv";
+    const char optstring[] = "+a:bc::d:f:ghH:ilo:p::qr:st:T:v";
 
     // for each command-line argument
     while ((i = getopt_long(narg, arg, optstring, longopts, NULL)) != -1) {
-        if (i == 'c') {
+        // arguments for the transport, replacing its defaults
+        if (i == 'a')
+            trans_args = optarg;
+
+        // send our standard input to every command
+        else if (i == 'b')
+            broadcast = true;
+
+        else if (i == 'c') {
             if (optarg) {
                 unsigned i = 0;
                 do optarg[i] = tolower(optarg[i]);
@@ -177,7 +413,7 @@ void parse_args(int narg, char *arg[])
             }
         }
 
-        // set delay between remote commands
+        // set delay between remote commands, the same as a rate
         else if (i == 'd') {
             // convert to double
             errno = 0;
@@ -190,11 +426,8 @@ void parse_args(int narg, char *arg[])
 
             debug_print(2, "delay: %f", full_delay);
 
-            delay.tv_sec  = (long)full_delay;
-            delay.tv_nsec = (long)((full_delay-floor(full_delay))*1000000000.0);
-
-            debug_print(2, "delay seconds: %ld", delay.tv_sec);
-            debug_print(2, "delay nanoseconds: %ld", delay.tv_nsec);
+            rate  = 1.0/full_delay;
+            burst = 1.0;
         }
 
         // specify host file
@@ -204,24 +437,58 @@ void parse_args(int narg, char *arg[])
                 debug_fail("Failed to open %s: %s", optarg, strerror(errno));
 
             debug_print(0, "opened input %s", optarg);
-
-            // need to close file somewhere if not stdin!!
         }
 
+        // group hosts with identical output
+        else if (i == 'g')
+            grouped = true;
+
         // print usage and quit
         else if (i == 'h') {
             print_usage();
             exit(EXIT_SUCCESS);
         }
 
+        // host name or range pattern, eg, node[001-100]
+        else if (i == 'H')
+            hostlist_add(&hosts, optarg);
+
         // allow interactive mode
         else if (i == 'i')
             interac = true;
 
+        // stream parallel output as it arrives
+        else if (i == 'l')
+            live = true;
+
+        // order in which to print parallel hosts
+        else if (i == 'o') {
+            unsigned i = 0;
+            do optarg[i] = tolower(optarg[i]);
+            while (optarg[++i] != '\0');
+
+            if (strcmp(optarg, "completion") == 0)
+                order = collect_completion;
+            else if (strcmp(optarg, "input") == 0)
+                order = collect_input;
+            else {
+                fprintf(stderr, "Invalid order: %s\n", optarg);
+                print_usage();
+                exit(EXIT_FAILURE);
+            }
+
+            debug_print(2, "order: %s", optarg);
+        }
+
         // setup parallel execution
         else if (i == 'p') {
             // if optional argument given
-            if (optarg) {
+            if (optarg && (strcmp(optarg, "auto") == 0)) {
+                // adapt to the hosts and the local machine
+                adaptive = true;
+                npar = npar_default;
+            }
+            else if (optarg) {
                 // set number of parallel commands
                 errno = 0;
                 npar = (unsigned)strtol(optarg, (char**)NULL, 10);
@@ -236,6 +503,124 @@ void parse_args(int narg, char *arg[])
         else if (i == 'q')
             debug_set(0);
 
+        // retry hosts that could not be reached
+        else if (i == 'r') {
+            char *end;
+
+            errno = 0;
+            retries = (unsigned)strtoul(optarg, &end, 10);
+            if ((errno != 0) || (end == optarg) || (*end != '\0'))
+                debug_fail("Invalid number of retries %s", optarg);
+        }
+
+        // run parallel commands in synchronized waves
+        else if (i == 's')
+            async = false;
+
+        // how to reach hosts, eg, ssh, rsh or local
+        else if (i == 't')
+            trans_name = optarg;
+
+        // stop commands that run too long
+        else if (i == 'T')
+            timeout = parse_time(optarg);
+
+        else if (i == opt_deadline)
+            deadline = parse_time(optarg);
+
+        else if (i == opt_progress)
+            progress = true;
+
+        // per host records, json lines or csv by extension
+        else if (i == opt_report)
+            report = optarg;
+
+        // token bucket limits on launches
+        else if (i == opt_rate)
+            parse_rate(optarg, &rate, &burst);
+
+        else if (i == opt_group_rate)
+            parse_rate(optarg, &group_rate, &group_burst);
+
+        // end the run early on enough failures or successes
+        else if ((i == opt_max_failures) || (i == opt_until_success)) {
+            char *end;
+            unsigned long n;
+
+            errno = 0;
+            n = strtoul(optarg, &end, 10);
+            if ((errno != 0) || (end == optarg) || (*end != '\0') || (n < 1) || (n > UINT_MAX))
+                debug_fail("Invalid number of hosts %s", optarg);
+
+            if (i == opt_max_failures)
+                max_failures = n;
+            else
+                until_success = n;
+        }
+
+        else if (i == opt_cancel)
+            cancel = true;
+
+        // canary batches growing to full parallelism
+        else if (i == opt_rollout)
+            rollout = true;
+
+        else if (i == opt_max_fail_rate) {
+            char *end;
+
+            errno = 0;
+            max_fail_rate = strtod(optarg, &end);
+            if (*end == '%')
+                ++end;
+            if ((errno != 0) || (end == optarg) || (*end != '\0') ||
+                    !(max_fail_rate >= 0.0) || (max_fail_rate > 100.0))
+                debug_fail("Invalid failure rate %s", optarg);
+        }
+
+        else if (i == opt_gate)
+            gate = optarg;
+
+        // skip hosts that do not accept connections
+        else if (i == opt_probe)
+            probe_port = optarg ? optarg : probe_port_default;
+
+        else if (i == opt_probe_timeout)
+            probe_timeout = parse_time(optarg);
+
+        else if (i == opt_probe_ttl) {
+            char *end;
+
+            errno = 0;
+            probe_ttl = strtol(optarg, &end, 10);
+            if ((errno != 0) || (end == optarg) || (*end != '\0') || (probe_ttl < 0))
+                debug_fail("Invalid probe ttl %s", optarg);
+        }
+
+        else if (i == opt_probe_cache)
+            probe_cache = optarg;
+
+        // fan out through relays running sshall
+        else if ((i == opt_fanout) || (i == opt_depth)) {
+            char *end;
+            unsigned long n;
+
+            errno = 0;
+            n = strtoul(optarg, &end, 10);
+            if ((errno != 0) || (end == optarg) || (*end != '\0') || (n < 1) || (n > UINT_MAX))
+                debug_fail("Invalid %s %s", i == opt_fanout ? "fanout" : "depth", optarg);
+
+            if (i == opt_fanout)
+                fanout = n;
+            else
+                depth = n;
+        }
+
+        else if (i == opt_relay_cmd)
+            relay_cmd = optarg;
+
+        else if (i == opt_frame)
+            frame = true;
+
         else if (i == 'v') {
             if (debug > 0) {
                 ++debug;
@@ -243,6 +628,34 @@ void parse_args(int narg, char *arg[])
             }
         }
 
+        // set thresholds for spilling output to disk
+        else if (i == opt_spill_host)
+            spill_host = parse_size(optarg);
+
+        else if (i == opt_spill_total)
+            spill_total = parse_size(optarg);
+
+        // number of hosts held back when printing in input order
+        else if (i == opt_reorder) {
+            errno = 0;
+            reorder = (unsigned)strtol(optarg, (char**)NULL, 10);
+            if ((errno != 0) || (reorder < 1))
+                debug_fail("Invalid reorder window %s", optarg);
+        }
+
+        else if (i == opt_unique)
+            unique = true;
+
+        // reuse master connections that persist between runs
+        else if (i == opt_pool)
+            pool = optarg ? optarg : ctlpool_persist_default;
+
+        else if (i == opt_pool_status)
+            pool_op = "check";
+
+        else if (i == opt_pool_stop)
+            pool_op = "exit";
+
         // print usage and quit on unknown argument
         else {
             print_usage();
@@ -250,6 +663,58 @@ void parse_args(int narg, char *arg[])
         }
     }
 
+    // waves, relays and rollouts need parallel execution
+    if ((!async || (fanout > 0) || rollout) && (npar < 1))
+        npar = npar_default;
+
+    if (rollout && (!async || (fanout > 0)))
+        debug_fail("Rollouts cannot be used with --sync or --fanout");
+
+    if (((gate != NULL) || (max_fail_rate > 0.0)) && !rollout)
+        debug_fail("--gate and --max-fail-rate need --rollout");
+
+    if ((fanout > 0) && (!async || live))
+        debug_fail("Relays cannot be used with --sync or --live");
+
+    // timeouts, retries, reports and grouping need the scheduler, run one host at a time through it
+    if ((npar < 1) && ((timeout.tv_sec != 0) || (timeout.tv_nsec != 0) ||
+                       (deadline.tv_sec != 0) || (deadline.tv_nsec != 0) ||
+                       (retries > 0) || (report != NULL) || grouped || frame ||
+                       (max_failures > 0) || (until_success > 0)))
+        npar = 1;
+
+    // relays only report how their whole share went
+    if ((fanout > 0) && ((max_failures > 0) || (until_success > 0)))
+        debug_fail("Relays cannot be used with --max-failures or --until-success");
+
+    // relays and waves read their own standard input
+    if (broadcast && ((fanout > 0) || !async))
+        debug_fail("Broadcast cannot be used with --sync or --fanout");
+
+    // commands come from standard input, one per line
+    if (interac && (broadcast || (fanout > 0) || !async || live))
+        debug_fail("Interactive mode cannot be used with --broadcast, --fanout, --sync or --live");
+
+    if (grouped && live)
+        debug_fail("Grouping needs whole outputs, it cannot be used with --live");
+
+    if ((trans = transport_find(trans_name)) == NULL)
+        debug_fail("Unknown transport %s", trans_name);
+
+    // only retry failures that are surely the transport's
+    if ((retries > 0) && (trans->unreachable < 0))
+        debug_fail("Retries are not supported by %s", trans->name);
+
+    if (((pool != NULL) || (pool_op != NULL)) && !trans->pool)
+        debug_fail("Connection pool is not supported by %s", trans->name);
+
+    // pool control commands run nothing else
+    if (pool_op != NULL) {
+        if (optind < narg)
+            debug_print(1, "Ignoring commands for pool control");
+        return;
+    }
+
     // skip remaining arguments if in interactive mode
     if (interac) {
         if (optind < narg)
@@ -283,320 +748,621 @@ void parse_args(int narg, char *arg[])
     }
 }
 
-/*
+/*  Return the next host, reachable or not, or NULL when done.
+*/
+char *host_any()
+{
+    return hostlist_next(&hosts);
+}
+
+/*  Return the next host to run on or NULL when done.
 */
 char *host_get()
 {
-    unsigned  i = 0;
-    unsigned  rbuff_cursize;
-    char      curc;
-    char     *rbuff;
-
-    /* consider using getline! */
-
-    // consume any spaces
-    do {
-        curc = fgetc(stdin);
-
-        // we're done if reached
-        // end before getting string
-        if (curc == EOF)
-            return NULL;
-    }
-    while(curc == '\n' ||
-            curc == '\r' ||
-            curc == ' '  ||
-            curc == '\0' );
-
-    rbuff = malloc(sizeof(char)*rbuff_isize);
-    rbuff_cursize = rbuff_isize;
-
-    while (curc != '\n' &&
-            curc != '\r' &&
-            curc != ' '  &&
-            curc != '\0' &&
-            curc != EOF  ) {
-        if (i > rbuff_cursize-2) {
-            rbuff = realloc(rbuff, rbuff_cursize+rbuff_isize);
-            if (rbuff == NULL)
-                debug_fail("%s", strerror(errno));
-            rbuff_cursize += rbuff_isize;
-        }
+    char *host;
 
-        rbuff[i++] = curc;
+    while (((host = hostlist_next(&hosts)) != NULL) && probe_dead(host));
 
-        curc = fgetc(stdin);
-    }
+    return host;
+}
 
-    // null terminate
-    rbuff[i] = '\0';
+/*  Return the number of hosts to run on.
+*/
+unsigned long host_count()
+{
+    unsigned long n = hostlist_count(&hosts);
 
-    return rbuff;
+    return n > probe_ndead() ? n - probe_ndead() : 0;
 }
 
-/*
+/*  Format the header printed before the output of host into a
+    newly allocated string.  If err is set, the error color is
+    left on for the output that follows.
 */
-void host_print(const char *host)
+char *host_header(const char *host, bool err)
 {
-    if(debug < 1)
-        return;
+    char  colhost[color_maxlen] = "";
+    char  coldash[color_maxlen] = "";
+    char  colres[color_maxlen]  = "";
+    char  colerr[color_maxlen]  = "";
+    char *head;
+    int   r;
 
     if (usecol) {
-        color_set(coltx_host, colfg_host, colbg_host);
-        printf("%s\n", host);
-        color_set(coltx_dash, colfg_dash, colbg_dash);
-        printf("-------\n");
-        color_reset();
-
-        //printf("%c[%d;%dm%s\n", col_esc, coltx_host, colfg_host, host);
-        //printf("%c[%d;%dm-------", col_esc, coltx_dash, colfg_dash);
-        //printf("%c[%dm\n", col_esc, col_res);
+        color_sset(colhost, sizeof(colhost), coltx_host, colfg_host, colbg_host);
+        color_sset(coldash, sizeof(coldash), coltx_dash, colfg_dash, colbg_dash);
+        color_sreset(colres, sizeof(colres));
+        if (err)
+            color_sset(colerr, sizeof(colerr), coltx_err, colfg_err, colbg_err);
     }
+
+    if (debug < 1)
+        r = asprintf(&head, "%s", colerr);
     else
-        printf("%s\n-------\n", host);
+        r = asprintf(&head, "%s%s\n%s-------\n%s%s", colhost, host, coldash, colres, colerr);
+
+    if (r < 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    return head;
+}
+
+/*
+*/
+void host_print(const char *host)
+{
+    char *head = host_header(host, false);
+
+    fputs(head, stdout);
+    free(head);
 }
 
 /*
 */
 void seq_run()
 {
+    char *arg[rcmd_argmax+3];
     char *host;
+    int   nargs;
+    int   tty;
+    double ms;
 
     debug_print(1, "Running sequentially", npar);
 
+    // commands read from the terminal, never from our host list
+    if (broadcast)
+        tty = -1;
+    else if ((tty = open("/dev/tty", O_RDONLY | O_CLOEXEC, 0x0)) < 0) {
+        debug_print(2, "no teletype, commands will read /dev/null");
+        if ((tty = open("/dev/null", O_RDONLY | O_CLOEXEC, 0x0)) < 0)
+            debug_fail_errno("Failed to open /dev/null");
+    }
+
+    for (nargs = 0; rcmd_argv[nargs] != NULL; ++nargs)
+        arg[nargs] = rcmd_argv[nargs];
+    arg[nargs+1] = command;
+    arg[nargs+2] = NULL;
+
     while ((host = host_get()) != NULL) {
         int    status;
         pid_t  id;
 
+        arg[nargs] = host;
+
+        // nothing else goes on, so waiting here stalls nothing
+        if ((launch_rate != NULL) && ((ms = ratelimit_wait(launch_rate, host)) > 0.0)) {
+            struct timespec wait = {.tv_sec = (time_t)(ms/1000.0),
+                                    .tv_nsec = (long)(fmod(ms, 1000.0)*1e6)};
+            while ((nanosleep(&wait, &wait) < 0) && (errno == EINTR));
+        }
+        if (launch_rate != NULL)
+            ratelimit_take(launch_rate, host);
+
+        if (broadcast)
+            tty = payload_input(0);
+
         host_print(host);
         fflush(stdin);
         fflush(stdout);
         fflush(stderr);
 
-        if ((id = fork()) < 0)
-            debug_warn_errno("Failed to fork");
+        if ((id = spawn_cmd(arg, tty, STDOUT_FILENO, STDOUT_FILENO)) < 0)
+            debug_warn_errno("Failed to spawn %s", trans->cmd);
 
-        else if (id == 0) {
-            char  *arg[] = {rcmd, cmd_args, host, command, NULL};
+        else if (waitpid(id, &status, 0) < 0)
+            debug_warn_errno("Failed to wait for child %s", trans->cmd);
 
-            int tty = open("/dev/tty", O_RDONLY, 0x0);
-            if (tty < 0)
-                debug_warn_errno("Failed to open teletype /dev/tty");
-            ioredir_set_in(tty);
-            ioredir_set_err(STDOUT_FILENO);
+        if (broadcast)
+            close(tty);
 
-            if (execvp(rcmd, arg) < 0)
-                debug_fail_errno("Failed to exec " rcmd);
-        }
+        if (debug > 0)
+            printf("\n");
+    }
 
-        // why else??  shouldn't you just exit above?
-        else if (wait(&status) < 0)
-            debug_warn_errno("Failed to wait for child " rcmd);
+    if (!broadcast)
+        close(tty);
+}
 
-        free(host);
+/*  Print the header and captured output of a finished host
+    with a single write when possible.
+*/
+void par_print(sched_job *j)
+{
+    bool err = (j->status != 0) && usecol;
+    char tail[color_maxlen+sizeof(cancelled_mark)+sizeof(timedout_mark)+1] = "";
+    struct iovec head_iov, tail_iov;
+    char *head = host_header(j->host, err);
+
+    if (j->timedout)
+        strcat(tail, timedout_mark);
+    else if (j->cancelled)
+        strcat(tail, cancelled_mark);
+    if (err)
+        color_sreset(tail+strlen(tail), sizeof(tail)-strlen(tail));
+    if (debug > 0)
+        strcat(tail, "\n");
 
-        if (debug > 0)
-            printf("\n");
+    head_iov.iov_base = head;
+    head_iov.iov_len  = strlen(head);
+    tail_iov.iov_base = tail;
+    tail_iov.iov_len  = strlen(tail);
 
-        if (nanosleep(&delay,NULL) < 0)
-            debug_fail_errno("Failed to sleep");
-    }
+    progress_clear();
+    fflush(stdout);
+    if (outbuf_write(&j->out, STDOUT_FILENO, &head_iov, &tail_iov) < 0)
+        debug_fail_errno("Failed to write output");
+
+    free(head);
 }
 
-/*
+/*  Write str to f in single quotes for the shell.
 */
-void par_sync_run()
+void shell_quote(FILE *f, const char *str)
 {
-    debug_print(1, "Running %d in parallel synchronously", npar);
+    fputc('\'', f);
+    for (; *str != '\0'; ++str)
+        if (*str == '\'')
+            fputs("'\\''", f);
+        else
+            fputc(*str, f);
+    fputc('\'', f);
 }
 
-/*
+/*  Build the command run on relays, which reads its hosts from
+    standard input and reaches them with the same transport and
+    options, relaying further if depth remains.
 */
-void par_async_monitor(char *host, int lock_fd)
+char *relay_command()
 {
-    int temp_fd;
-    int status;
-    pid_t id;
+    char *args = trans_args != NULL ? trans_args : getenv("SSHALL_ARGS");
+    char *cmd;
+    size_t size;
+    FILE *f;
 
-    // create temp file
-    const unsigned temp_namelen = 31+strlen(host)+strlen(prog_name);
-    char *temp_name = (char*)malloc(sizeof(char)*temp_namelen);
-    snprintf(temp_name, sizeof(char)*temp_namelen, "/tmp/%s-%s-XXXXXX", prog_name, host);
+    if ((f = open_memstream(&cmd, &size)) == NULL)
+        debug_fail_errno("Failed to allocate memory");
 
-    //if ((temp_fd = mkstemp(temp_name)) < 0)
-    if ((temp_fd = mkostemp(temp_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC)) < 0)
-        debug_fail_errno("Failed to open tempfile %s", temp_name);
+    fprintf(f, "%s --frame -q -t ", relay_cmd);
+    shell_quote(f, trans_name);
 
-    debug_print(2, "using temp file %s", temp_name);
+    if (args != NULL) {
+        fputs(" -a ", f);
+        shell_quote(f, args);
+    }
 
-    ioredir_desc iod = ioredir_set_out(temp_fd);
+    if (adaptive)
+        fputs(" -pauto", f);
+    else
+        fprintf(f, " -p%u", npar);
+
+    if ((timeout.tv_sec != 0) || (timeout.tv_nsec != 0))
+        fprintf(f, " -T %ld.%09ld", (long)timeout.tv_sec, timeout.tv_nsec);
+    if ((deadline.tv_sec != 0) || (deadline.tv_nsec != 0))
+        fprintf(f, " --deadline %ld.%09ld", (long)deadline.tv_sec, deadline.tv_nsec);
+    if (retries > 0)
+        fprintf(f, " -r %u", retries);
+
+    // relays share the rates between them
+    if (rate > 0.0)
+        fprintf(f, " --rate %g:%g", rate/fanout, burst/fanout > 1.0 ? burst/fanout : 1.0);
+    if (group_rate > 0.0)
+        fprintf(f, " --group-rate %g:%g", group_rate/fanout,
+                group_burst/fanout > 1.0 ? group_burst/fanout : 1.0);
+
+    if (depth > 1) {
+        fprintf(f, " --fanout %u --depth %u --relay-cmd ", fanout, depth-1);
+        shell_quote(f, relay_cmd);
+    }
 
-    fflush(stdin);
-    fflush(stdout);
-    fflush(stderr);
+    fputs(" -- ", f);
+    shell_quote(f, command);
 
-    // fork and exec ssh
-    if ((id = fork()) < 0)
-        debug_warn_errno("Failed to fork");
+    if (fclose(f) != 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    debug_print(3, "relay command: %s", cmd);
+
+    return cmd;
+}
 
-    else if (id == 0) {
-        char *arg[] = {rcmd, cmd_args, host, command, NULL};
+/*  Decide whether a rollout goes on to its next batch.  No more
+    than max_fail_rate percent of the hosts in the last batch may
+    have failed and the gate command, if any, must exit with status
+    zero.  The gate runs in a local shell with the batch number and
+    the hosts done and failed so far in $SSHALL_BATCH, $SSHALL_DONE
+    and $SSHALL_FAILED.  Matches sched_opts.gate.
+*/
+bool rollout_gate(const sched_stats *s)
+{
+    static unsigned nfailed = 0, ndone = 0;
+    unsigned bfailed = s->nfailed - nfailed;
+    unsigned bdone = s->nfailed + s->nsucceeded - ndone;
+    char *arg[] = {"sh", "-c", gate, NULL};
+    char val[3][16];
+    int status, null;
+    pid_t id;
 
-        int tty = open("/dev/tty", O_RDONLY, 0x0);
-        if (tty < 0)
-            debug_warn_errno("Failed to open teletype /dev/tty");
-        ioredir_set_in(tty);
-        ioredir_set_err(STDOUT_FILENO);
+    nfailed = s->nfailed;
+    ndone   = s->nfailed + s->nsucceeded;
 
-        /***
-          when to fail vs error in fork?
-          prolly need to check exit status
-         ***/
+    progress_clear();
 
-        if (execvp(rcmd, arg) < 0)
-            debug_fail_errno("Failed to exec " rcmd);
+    if ((bdone > 0) && (100.0*bfailed/bdone > max_fail_rate)) {
+        debug_warn("Batch %u failed on %u of %u hosts, stopping", s->nbatches, bfailed, bdone);
+        exit_status = EXIT_FAILURE;
+        return false;
     }
 
-    else if (wait(&status) < 0)
-        debug_warn_errno("Failed to wait for child " rcmd);
+    if (gate == NULL)
+        return true;
+
+    snprintf(val[0], sizeof(val[0]), "%u", s->nbatches);
+    snprintf(val[1], sizeof(val[1]), "%u", ndone);
+    snprintf(val[2], sizeof(val[2]), "%u", nfailed);
+    if ((setenv("SSHALL_BATCH", val[0], 1) < 0) || (setenv("SSHALL_DONE", val[1], 1) < 0) ||
+            (setenv("SSHALL_FAILED", val[2], 1) < 0))
+        debug_fail_errno("Failed to set environment");
+
+    if ((null = open("/dev/null", O_RDONLY | O_CLOEXEC)) < 0)
+        debug_fail_errno("Failed to open /dev/null");
 
     fflush(stdout);
-    if (fseek(stdout, 0, SEEK_SET) != 0)
-        debug_fail_errno("Seek failed on stream for %s", temp_name);
-    /*if (lseek(temp_fd, 0, SEEK_SET) < 0)
-      debug_fail_errno("Seek failed on %s", temp_name); */
-    //
-    ioredir_restore(iod);
+    if ((id = spawn_cmd(arg, null, STDOUT_FILENO, STDERR_FILENO)) < 0)
+        debug_fail_errno("Failed to spawn gate");
+    close(null);
+
+    while (waitpid(id, &status, 0) < 0)
+        if (errno != EINTR)
+            debug_fail_errno("Failed to wait for gate");
+
+    if (status != 0) {
+        debug_warn("Gate failed after batch %u, stopping", s->nbatches);
+        exit_status = EXIT_FAILURE;
+        return false;
+    }
 
-    FILE* temp_file = fdopen(temp_fd, "r+");
+    return true;
+}
 
-    //
-    if (lockf(lock_fd, F_LOCK, 0) != 0)
-        debug_fail_errno("Unable to obtain file lock");
+/*  Count a finished host in the status line and the report,
+    then print it.
+*/
+void par_finish(sched_job *j)
+{
+    progress_add(j);
+    report_add(j);
+    par_done(j);
+}
 
-    debug_print(3, "output locked");
+/*  Run the scheduler with output either streamed live or
+    collected and printed per host, with a status line if asked.
+*/
+void par_run(sched_opts *opts)
+{
+    char colhost[color_maxlen] = "";
+    char colerr[color_maxlen]  = "";
+    char colres[color_maxlen]  = "";
+    sched_stats stats;
+
+    // relays send each host back to their parent
+    if (frame)
+        opts->done = tree_frame;
+
+    else if (live) {
+        if (usecol) {
+            color_sset(colhost, sizeof(colhost), coltx_host, colfg_host, colbg_host);
+            color_sset(colerr, sizeof(colerr), coltx_err, colfg_err, colbg_err);
+            color_sreset(colres, sizeof(colres));
+        }
 
-    host_print(host);
+        stream_init(colhost, colerr, colres);
+        opts->output = stream_output;
+        opts->done   = stream_done;
+    }
 
-    if ((status != 0) && usecol)
-        color_set(coltx_err, colfg_err, colbg_err);
+    else if (grouped) {
+        group_init();
+        opts->done = group_add;
+    }
 
-    //
-    while (true) {
-        /*    char c;
-              size_t r = read(temp_fd, &c, 1);
-              if (r == 0)
-              break;
-              else if (r < 0)
-              debug_fail_errno("Failed to read temp file %s", temp_name);
-
-              if (write(STDOUT_FILENO, &c, 1) < 0)
-              debug_fail_errno("Failed to write output"); */
-
-        char rbuff[rbuff_isize];
-        size_t r = fread(rbuff, sizeof(char), rbuff_isize, temp_file);
-        if (r == 0)
-            break;
-        else if (r < 0) {
-            if (usecol)
-                color_reset();
-            debug_fail_errno("Failed to read temp file %s", temp_name);
-        }
+    else {
+        collect_init(order, reorder, par_print);
+        opts->done = collect_add;
+    }
 
-        if (fwrite(rbuff, sizeof(char), r, stdout) < 0)
-            debug_fail_errno("Failed to write output");
+    // every command reads the payload from its start
+    if (broadcast)
+        opts->input = payload_input;
+
+    if (progress) {
+        progress_init(host_count());
+        opts->status = progress_status;
     }
 
-    if ((status != 0) && usecol)
-        color_reset();
+    if (progress || (report != NULL)) {
+        par_done   = opts->done;
+        opts->done = par_finish;
+    }
 
-    if (debug > 0)
-        printf("\n");
+    // reach the hosts through relays, which handle timeouts and adapt themselves
+    if (fanout > 0) {
+        tree_init(opts->next, host_count(), fanout, opts->done);
+        opts->next    = tree_next;
+        opts->input   = tree_input;
+        opts->output  = tree_output;
+        opts->done    = tree_finish;
+        opts->command = relay_command();
+        opts->npar    = fanout;
+        opts->adapt   = NULL;
+        memset(&opts->timeout, 0, sizeof(opts->timeout));
+    }
 
-    debug_print(3, "unlocking output");
-    fflush(stdout);
+    stats = sched_run(opts);
 
-    //
-    if (lockf(lock_fd, F_ULOCK, 0) != 0)
-        debug_fail_errno("Unable to free file lock");
+    // the run failed if it ended on failures or fell short of its successes
+    if (((max_failures > 0) && (stats.nfailed >= max_failures)) ||
+            ((until_success > 0) && (stats.nsucceeded < until_success)))
+        exit_status = EXIT_FAILURE;
+
+    // so did a wave that did not start everywhere
+    if (stats.nunstarted > 0) {
+        debug_warn("%u hosts never started their command in a wave", stats.nunstarted);
+        exit_status = EXIT_FAILURE;
+    }
 
-    debug_print(2, "removing tempfile %s", temp_name);
+    if (fanout > 0) {
+        // hosts lost with their relay failed too
+        if (tree_nfailed() > 0)
+            exit_status = EXIT_FAILURE;
+        tree_free();
+        free(opts->command);
+    }
 
-    //  close(temp_fd);
-    fclose(temp_file);
-    remove(temp_name);
+    if (grouped)
+        group_flush(par_print);
+    else if (!live && !frame)
+        collect_flush();
 
-    exit(EXIT_SUCCESS);
+    if (progress)
+        progress_end();
 }
 
 /*
 */
-void par_async_wait(int *nrunning)
+void par_async_run()
 {
-    int status;
+    adapt ad;
+    sched_opts opts = {
+        .npar    = npar,
+        .argv    = rcmd_argv,
+        .command = command,
+        .rate    = launch_rate,
+        .timeout = timeout,
+        .deadline = deadline,
+        .retries = retries,
+        .unreachable = trans->unreachable,
+        .max_failures = max_failures,
+        .until_success = until_success,
+        .cancel  = cancel,
+        .rollout = rollout,
+        .gate    = rollout ? rollout_gate : NULL,
+        .next    = host_get
+    };
+
+    // relays adapt, not the parent
+    if (adaptive && (fanout == 0)) {
+        // two pipes and a possible spill file per command
+        opts.npar = adapt_ceiling(3);
+        adapt_init(&ad, npar_default, opts.npar);
+        opts.adapt = &ad;
+        debug_print(1, "running up to %u in parallel adaptively", opts.npar);
+    }
+    else if (rollout)
+        debug_print(1, "rolling out in batches of up to %d", npar);
+    else
+        debug_print(1, "running %d in parallel asynchronously", npar);
 
-    if (wait(&status) < 0)
-        debug_warn_errno("Failed to wait for sync_run child");
+    par_run(&opts);
 
-    --(*nrunning);
+    if (adaptive && (fanout == 0))
+        adapt_report(&ad);
 }
 
 /*
 */
-void par_async_run()
+void par_sync_run()
 {
-    int   nrunning = 0;
-    int   lock_fd = STDOUT_FILENO;
-    char *lock_name = NULL;
-    char *host;
+    adapt ad;
+    sched_opts opts = {
+        .npar    = npar,
+        .argv    = rcmd_argv,
+        .command = command,
+        .rate    = launch_rate,
+        .sync    = true,
+        .timeout = timeout,
+        .deadline = deadline,
+        .retries = retries,
+        .unreachable = trans->unreachable,
+        .max_failures = max_failures,
+        .until_success = until_success,
+        .cancel  = cancel,
+        .next    = host_get
+    };
 
-    debug_print(1, "running %d in parallel asynchronously", npar);
+    if (adaptive) {
+        // and the go signal pipe
+        opts.npar = adapt_ceiling(4);
+        adapt_init(&ad, npar_default, opts.npar);
+        opts.adapt = &ad;
+        debug_print(1, "Running waves of up to %u in parallel adaptively", opts.npar);
+    }
+    else
+        debug_print(1, "Running %d in parallel synchronously", npar);
 
-    // always use lock file or can use log file or tty stdout?
-    /*  if (isatty(STDOUT_FILENO))
-        { */
-    const unsigned lock_namelen = 31+strlen(prog_name);
-    lock_name = (char*)malloc(sizeof(char)*lock_namelen);
-    snprintf(lock_name, sizeof(char)*lock_namelen, "/tmp/%s-lockfile-XXXXXX", prog_name);
+    par_run(&opts);
 
-    if ((lock_fd = mkostemp(lock_name, lockfile_flags)) < 0)
-        debug_fail_errno("Failed to open lockfile %s", lock_name);
+    if (adaptive)
+        adapt_report(&ad);
+}
 
-    debug_print(2, "using lockfile %s", lock_name);
-    //}
+/*  Read commands from standard input and run each on every host
+    through a shell kept open on the host between commands, which
+    is started again only if it ends.
+*/
+void interac_run()
+{
+    bool prompt = isatty(STDIN_FILENO) && (debug > 0);
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
 
-    while ((host = host_get()) != NULL) {
-        pid_t id;
+    debug_print(1, "Running interactively, end with EOF");
+
+    // as many sessions open as the open file limit allows when adapting
+    session_init(rcmd_argv, host_get, adaptive ? UINT_MAX : npar > 0 ? npar : npar_default,
+                 launch_rate);
+
+    for (;;) {
+        void (*done)(sched_job *j);
+
+        if (prompt) {
+            fprintf(stderr, "%s> ", prog_name);
+            fflush(stderr);
+        }
+
+        if ((len = getline(&line, &size, stdin)) < 0)
+            break;
+
+        if ((len > 0) && (line[len-1] == '\n'))
+            line[--len] = '\0';
+
+        if (line[strspn(line, " \t")] == '\0')
+            continue;
+
+        if (grouped) {
+            group_init();
+            done = group_add;
+        }
+        else {
+            collect_init(order, reorder, par_print);
+            done = collect_add;
+        }
+
+        if (report != NULL) {
+            par_done = done;
+            done = par_finish;
+        }
+
+        session_run(line, timeout, done);
+
+        if (grouped)
+            group_flush(par_print);
+        else
+            collect_flush();
 
-        fflush(stdin);
         fflush(stdout);
-        fflush(stderr);
+    }
 
-        if ((id = fork()) < 0)
-            debug_warn_errno("Failed to fork");
+    if (prompt)
+        fputc('\n', stderr);
 
-        else if (id == 0)
-            par_async_monitor(host, lock_fd);
+    free(line);
+    session_free();
+}
 
-        else if (++nrunning >= npar)
-            par_async_wait(&nrunning);
+/*  Append arguments to the remote command.
+*/
+void rcmd_argv_add(char **args)
+{
+    unsigned n;
 
-        free(host);
+    for (n = 0; rcmd_argv[n] != NULL; ++n);
 
-        if (nanosleep(&delay,NULL) < 0)
-            debug_fail_errno("Failed to sleep");
+    for (; *args != NULL; ++args) {
+        if (n == rcmd_argmax)
+            debug_fail("Too many arguments for %s", trans->cmd);
+        rcmd_argv[n++] = *args;
     }
 
-    // wait for remaining monitors to finish
-    while (nrunning > 0)
-        par_async_wait(&nrunning);
+    rcmd_argv[n] = NULL;
+}
+
+/*  Build the remote command from the transport, using arguments
+    from --args or else $SSHALL_ARGS in place of its defaults.
+    Waves, relays, broadcasts and sessions write to the standard
+    input of their commands, which is otherwise left unread.
+*/
+void rcmd_argv_init()
+{
+    char *args = trans_args != NULL ? trans_args : getenv("SSHALL_ARGS");
+    bool input = broadcast || interac || !async || (fanout > 0);
+    char *one[] = {NULL, NULL};
+    char *save;
 
-    /*if (lock_name != NULL)
-      {*/
-    debug_print(2, "closing lockfile");
-    close(lock_fd);
-    remove(lock_name);
-    //}
+    rcmd_argv[0] = trans->cmd;
+    rcmd_argv[1] = NULL;
+
+    if (!input && (trans->noinput != NULL)) {
+        one[0] = trans->noinput;
+        rcmd_argv_add(one);
+    }
+
+    if (args == NULL)
+        rcmd_argv_add(trans->args);
+
+    // split on white space, the string is ours to keep
+    else {
+        if ((args = strdup(args)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+
+        for (one[0] = strtok_r(args, " \t\n", &save); one[0] != NULL;
+             one[0] = strtok_r(NULL, " \t\n", &save))
+            rcmd_argv_add(one);
+    }
+
+    rcmd_argv_add(trans->tail);
+}
+
+/*  Send pool_op to the pooled master of every host in parallel
+    and stream the replies.
+*/
+void pool_run()
+{
+    sched_opts opts = {
+        .npar    = npar > 0 ? npar : npar_default,
+        .argv    = rcmd_argv,
+        .command = NULL,
+        .rate    = launch_rate,
+        .next    = host_get
+    };
+
+    rcmd_argv_add(ctlpool_ctl_args(pool_op));
+
+    live = true;
+    par_run(&opts);
+
+    if (strcmp(pool_op, "exit") == 0)
+        ctlpool_cleanup();
 }
 
 /*
@@ -606,15 +1372,69 @@ int main(int narg, char *arg[])
     //
     prog_name = basename(arg[0]);
 
+    hostlist_init(&hosts);
+
     parse_args(narg, arg);
 
-    ioredir_desc orig_in = ioredir_set_in(input);
+    // commands may exit before we are done writing to them
+    signal(SIGPIPE, SIG_IGN);
+
+    // read hosts from standard input unless given some other way
+    if (input > -1) {
+        hostlist_load(&hosts, input);
+        close(input);
+    }
+    else if ((broadcast || interac) && (hosts.n == 0))
+        debug_fail("%s needs hosts from --file or --hosts",
+                   interac ? "Interactive mode" : "Broadcast");
+    else if (hosts.n == 0)
+        hostlist_load(&hosts, STDIN_FILENO);
+
+    if (broadcast && (pool_op == NULL))
+        payload_init(STDIN_FILENO);
+
+    if (unique)
+        hostlist_dedup(&hosts);
+
+    outbuf_limit(spill_host, spill_total);
+
+    // find hosts that are down before they take up a slot
+    if ((probe_port != NULL) && (pool_op == NULL)) {
+        probe_run(host_any, probe_port, probe_timeout, probe_cache, probe_ttl);
+        hostlist_rewind(&hosts);
+    }
+
+    if ((rate > 0.0) || (group_rate > 0.0)) {
+        ratelimit_init(&limiter, rate, burst, group_rate, group_burst);
+        launch_rate = &limiter;
+    }
 
     if ((colstat == color_always) ||
             (colstat == color_auto && isatty(STDOUT_FILENO)))
         usecol = true;
 
-    if (npar < 1)
+    rcmd_argv_init();
+
+    if ((report != NULL) && (pool_op == NULL))
+        report_open(report);
+
+    if ((pool != NULL) || (pool_op != NULL))
+        ctlpool_init(pool != NULL ? pool : ctlpool_persist_default);
+
+    // warm the pool, then run through it
+    if ((pool != NULL) && (pool_op == NULL)) {
+        ctlpool_warm(rcmd_argv, host_get, npar > 0 ? npar : npar_default);
+        hostlist_rewind(&hosts);
+        rcmd_argv_add(ctlpool_args());
+    }
+
+    if (pool_op != NULL)
+        pool_run();
+
+    else if (interac)
+        interac_run();
+
+    else if (npar < 1)
         seq_run();
 
     else if (async)
@@ -623,7 +1443,12 @@ int main(int narg, char *arg[])
     else 
         par_sync_run();
 
-    ioredir_restore(orig_in);
+    report_close();
+    payload_free();
+    probe_free();
+    if (launch_rate != NULL)
+        ratelimit_free(launch_rate);
+    hostlist_free(&hosts);
 
-    return 0;
+    return exit_status;
 }
@@ -0,0 +1,231 @@
+/*
+ *  Stream output line by line with host name prefixes.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "stream.h"
+#include "colorset.h"
+#include "debug.h"
+#include "progress.h"
+
+#define stream_linemax 65536    // longest partial line held back
+#define stream_niov    1024     // vectors per writev
+
+/* partial line of one stream */
+typedef struct {
+    char   *data;
+    size_t  len;
+} stream_line;
+
+/* streaming state of a host, kept in sched_job.priv */
+typedef struct {
+    char        *prefix;                // colored host name and separator
+    size_t       prefixlen;             // length of prefix
+    stream_line  part[sched_nstream];   // partial line of each stream
+} stream_host;
+
+static char stream_colhost[color_maxlen] = "";
+static char stream_colerr[color_maxlen]  = "";
+static char stream_colres[color_maxlen]  = "";
+
+/*  Setup streaming, which must be done before the first host
+    produces output.  Empty color strings disable colors.
+
+    Args:
+        colhost:    escape sequence for host names.
+
+        colerr:     escape sequence for failures.
+
+        colres:     escape sequence to reset colors.
+*/
+void stream_init(const char *colhost, const char *colerr, const char *colres)
+{
+    snprintf(stream_colhost, sizeof(stream_colhost), "%s", colhost);
+    snprintf(stream_colerr,  sizeof(stream_colerr),  "%s", colerr);
+    snprintf(stream_colres,  sizeof(stream_colres),  "%s", colres);
+}
+
+/*  Return the streaming state of a host, creating it if needed.
+*/
+static stream_host *stream_get(sched_job *j)
+{
+    stream_host *h;
+    int r;
+
+    if (j->priv != NULL)
+        return j->priv;
+
+    if ((h = calloc(1, sizeof(stream_host))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    if ((r = asprintf(&h->prefix, "%s%s%s: ", stream_colhost, j->host, stream_colres)) < 0)
+        debug_fail_errno("Failed to allocate memory");
+    h->prefixlen = r;
+
+    return j->priv = h;
+}
+
+/*  Write n vectors to standard output, failing on error.
+*/
+static void stream_write(struct iovec *iov, int n)
+{
+    progress_clear();
+
+    if (outbuf_putv(STDOUT_FILENO, iov, n) < 0)
+        debug_fail_errno("Failed to write output");
+}
+
+/*  Print the complete lines in data, each prefixed with the host
+    name, and hold any trailing partial line until it is finished.
+    Lines from different hosts and streams are never interleaved.
+    Matches sched_opts.output.
+
+    Args:
+        j:      host that produced the output.
+
+        s:      stream the output was read from.
+
+        data:   output read from the host.
+
+        len:    number of bytes in data.
+*/
+void stream_output(sched_job *j, sched_stream s, const char *data, size_t len)
+{
+    stream_host *h = stream_get(j);
+    stream_line *part = &h->part[s];
+    struct iovec iov[stream_niov];
+    const char *end = data+len;
+    const char *last, *nl;
+    int n = 0;
+
+    // everything after the last newline is held back
+    if ((last = memrchr(data, '\n', len)) == NULL) {
+        if (part->len+len > stream_linemax) {
+            // too long to hold, print what we have as a line
+            stream_output(j, s, "\n", 1);
+            part = &h->part[s];
+        }
+
+        if ((part->data = realloc(part->data, part->len+len)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        memcpy(part->data+part->len, data, len);
+        part->len += len;
+        return;
+    }
+
+    fflush(stdout);
+
+    for (nl = data; data <= last; data = nl+1) {
+        nl = memchr(data, '\n', last+1-data);
+
+        // leave room for a prefix, a partial line and this line
+        if (n > stream_niov-3) {
+            stream_write(iov, n);
+            n = 0;
+        }
+
+        iov[n].iov_base = h->prefix;
+        iov[n++].iov_len = h->prefixlen;
+
+        if (part->len > 0) {
+            iov[n].iov_base = part->data;
+            iov[n++].iov_len = part->len;
+        }
+
+        iov[n].iov_base = (char*)data;
+        iov[n++].iov_len = nl+1-data;
+
+        // held partial line only joins the first line
+        if (part->len > 0) {
+            stream_write(iov, n);
+            n = 0;
+            part->len = 0;
+        }
+    }
+
+    if (n > 0)
+        stream_write(iov, n);
+
+    if (data < end)
+        stream_output(j, s, data, end-data);
+}
+
+/*  Print any partial lines left by a finished host, followed by
+    its exit status if it failed or a note if it timed out or
+    was cancelled.
+    Matches sched_opts.done.
+
+    Args:
+        j:  finished host.
+*/
+void stream_done(sched_job *j)
+{
+    stream_host *h = stream_get(j);
+    sched_stream s;
+
+    for (s = sched_out; s < sched_nstream; ++s)
+        if (h->part[s].len > 0)
+            stream_output(j, s, "\n", 1);
+
+    if (j->timedout || j->cancelled || (j->status != 0))
+        progress_clear();
+
+    if (j->timedout || j->cancelled) {
+        printf("%s%s%s%s\n", h->prefix, stream_colerr,
+               j->timedout ? "timed out" : "cancelled", stream_colres);
+        fflush(stdout);
+    }
+
+    else if (j->status != 0) {
+        if (WIFSIGNALED(j->status))
+            printf("%s%sterminated by signal %d%s\n", h->prefix,
+                   stream_colerr, WTERMSIG(j->status), stream_colres);
+        else
+            printf("%s%sexited with status %d%s\n", h->prefix,
+                   stream_colerr, WEXITSTATUS(j->status), stream_colres);
+        fflush(stdout);
+    }
+
+    for (s = sched_out; s < sched_nstream; ++s)
+        free(h->part[s].data);
+    free(h->prefix);
+    free(h);
+    j->priv = NULL;
+}
@@ -0,0 +1,78 @@
+/*
+ *  Stream output line by line with host name prefixes.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef stream_h
+    #define stream_h
+
+    #include <stddef.h>
+
+    #include "sched.h"
+
+    /*  Setup streaming, which must be done before the first host
+        produces output.  Empty color strings disable colors.
+
+        Args:
+            colhost:    escape sequence for host names.
+
+            colerr:     escape sequence for failures.
+
+            colres:     escape sequence to reset colors.
+    */
+    void stream_init(const char *colhost, const char *colerr, const char *colres);
+
+    /*  Print the complete lines in data, each prefixed with the host
+        name, and hold any trailing partial line until it is finished.
+        Lines from different hosts and streams are never interleaved.
+        Matches sched_opts.output.
+
+        Args:
+            j:      host that produced the output.
+
+            s:      stream the output was read from.
+
+            data:   output read from the host.
+
+            len:    number of bytes in data.
+    */
+    void stream_output(sched_job *j, sched_stream s, const char *data, size_t len);
+
+    /*  Print any partial lines left by a finished host, followed by
+        its exit status if it failed or a note if it timed out or
+        was cancelled.
+        Matches sched_opts.done.
+
+        Args:
+            j:  finished host.
+    */
+    void stream_done(sched_job *j);
+
+#endif
@@ -0,0 +1,126 @@
+#!/bin/sh
+#
+#  Regression tests for sshall run through the local transport.
+#
+#  Each test runs sshall with -t local, so no network or ssh is
+#  needed, and compares what it prints with what is expected.
+#  Prints one line per test and exits non-zero if any failed.
+#
+
+cd "$(dirname "$0")/.." || exit 1
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+nfail=0
+
+# name expected actual
+check()
+{
+    if [ "$2" = "$3" ]; then
+        printf 'ok    %s\n' "$1"
+    else
+        printf 'FAIL  %s\n      expected: %s\n      got:      %s\n' "$1" "$2" "$3"
+        nfail=$((nfail + 1))
+    fi
+}
+
+# hosts sshall runs on for the host list in file $1, sorted
+hosts_of()
+{
+    ./sshall -q -t local -p4 'echo "$SSHALL_HOST"' < "$1" 2>/dev/null |
+        grep -v -e '^-*$' -e '^ *$' | sort -u | tr '\n' ' '
+}
+
+# a comment holding a range pattern is not a pattern
+printf 'a\n# retired: rack[old]\nb # spare[1-2]\nc#x[\n' > "$tmp/comment"
+check "bracketed comment" "a b c " "$(hosts_of "$tmp/comment")"
+
+# patterns are expanded where they appear
+printf 'n[1-3]\nm{a,b}\n' > "$tmp/pattern"
+check "range patterns" "ma mb n1 n2 n3 " "$(hosts_of "$tmp/pattern")"
+
+# loading grows linearly, 400000 names with a trailing pattern
+# load in well under the time limit
+seq -f 'host%g' 400000 > "$tmp/large"
+echo 'node[1-3]' >> "$tmp/large"
+start=$(date +%s)
+n=$(./sshall -q -t local -p1 --max-failures 1 false < "$tmp/large" >/dev/null 2>&1; echo $?)
+check "large host list loads" "1 fast" "$n $( [ $(( $(date +%s) - start )) -lt 5 ] && echo fast || echo slow)"
+
+# dead hosts cached by other runs are not counted in this one
+now=$(date +%s)
+printf '%s 22 gone1\n%s 22 gone2\n%s 22 127.0.0.9\n' "$now" "$now" "$now" > "$tmp/cache"
+printf 'nosuch.invalid\n127.0.0.9\n' > "$tmp/probed"
+check "cached dead hosts of this run" "1 hosts unreachable, 1 of them cached, skipping them." \
+    "$(./sshall -v -t local --probe=22 --probe-cache "$tmp/cache" true < "$tmp/probed" 2>&1 |
+        grep '^[0-9]* hosts unreachable')"
+
+# a stand in for rsh that honors -n and cannot reach host down
+mkdir "$tmp/bin"
+printf '%s\n' '#!/bin/sh' '[ "$1" = -n ] && { exec < /dev/null; shift; }' \
+    '[ "$1" = down ] && exit 255' 'exec sh -c "$2"' > "$tmp/bin/rsh"
+chmod +x "$tmp/bin/rsh"
+printf 'a\nb\n' > "$tmp/two"
+printf 'a\nb\nc\n' > "$tmp/three"
+printf 'a\ndown\n' > "$tmp/down"
+
+# waves write the go signal to rsh, so it must read its input
+check "rsh waves read their input" "2" \
+    "$(PATH="$tmp/bin:$PATH" ./sshall -q -t rsh -s -p2 'echo x' < "$tmp/two" 2>/dev/null | grep -c '^x$')"
+
+# otherwise rsh reads nothing
+check "rsh commands read no input" "" \
+    "$(echo leak | PATH="$tmp/bin:$PATH" ./sshall -q -t rsh -H a cat 2>/dev/null | grep leak)"
+
+# a wave that does not start everywhere fails the run
+n=$(PATH="$tmp/bin:$PATH" ./sshall -q -t rsh -s -p2 true < "$tmp/down" >/dev/null 2>&1; echo $?)
+check "failed wave exits non-zero" "1" "$n"
+
+# a stand in for ssh, and a relay that exits as unreachable after one record
+printf '%s\n' '#!/bin/sh' 'while [ "${1#-}" != "$1" ]; do shift; done' \
+    'exec sh -c "$2"' > "$tmp/bin/ssh"
+printf '%s\n' '#!/bin/sh' "\"$PWD/sshall\" \"\$@\" | awk 'NR <= 2'" 'exit 255' > "$tmp/relay"
+chmod +x "$tmp/bin/ssh" "$tmp/relay"
+printf 'a\nb\nc\nd\n' > "$tmp/four"
+
+# a relay that sent records is not retried, the hosts it lost fail
+out=$(PATH="$tmp/bin:$PATH" ./sshall -q -t ssh -r 2 --fanout 2 --relay-cmd "$tmp/relay" -p2 \
+    'echo x' < "$tmp/four" 2>/dev/null; echo "exit $?")
+check "relays run once" "2" "$(echo "$out" | grep -c '^x$')"
+check "hosts lost by relays fail" "2 exit 1" \
+    "$(echo "$out" | grep -c '^not reported by relay') $(echo "$out" | tail -n 1)"
+
+# a host whose command cannot be spawned still takes its place in order
+check "spawn failures are reported" "a b c " \
+    "$(PATH=/nonexistent ./sshall -t rsh -p2 -o input true < "$tmp/three" 2>/dev/null |
+        grep -x '[abc]' | tr '\n' ' ')"
+
+# sessions closed to make room, or ended by a command, start again
+out=$(printf 'echo hi\nexit 3\necho again\n' |
+    ./sshall -q -t local -i -H a -H b -H c -p1 2>/dev/null)
+check "sessions start again" "3 3" "$(echo "$out" | grep -c '^hi$') $(echo "$out" | grep -c '^again$')"
+
+# output spills only once it is past the per host limit
+spills()
+{
+    ./sshall -vvv -t local -p2 --spill-host 100 "head -c $1 /dev/zero | tr '\\0' x" < "$tmp/one" 2>&1 |
+        grep -c 'spilling'
+}
+printf 'a\n' > "$tmp/one"
+check "output under the limit stays in memory" "0 0" "$(spills 0) $(spills 100)"
+check "output past the limit spills" "1" "$(spills 101)"
+check "spilled output is kept whole" "5000" \
+    "$(./sshall -q -t local -p2 --spill-host 100 "head -c 5000 /dev/zero | tr '\\0' x" < "$tmp/one" |
+        tr -cd x | wc -c | tr -d ' ')"
+
+# warming the pool frees a slot as soon as any host is ready,
+# so two slow hosts warm side by side rather than one after the other
+printf '%s\n' '#!/bin/sh' 'while [ "${1#-}" != "$1" ]; do shift; done' \
+    'case "$1" in slow*) [ "$2" = true ] && sleep 2;; esac' 'exec sh -c "$2"' > "$tmp/bin/ssh"
+printf 'slow1\na\nb\nc\nslow2\n' > "$tmp/slow"
+start=$(date +%s)
+XDG_RUNTIME_DIR="$tmp" PATH="$tmp/bin:$PATH" ./sshall -q -t ssh -p2 --pool : < "$tmp/slow"
+check "pool warms out of order" "fast" "$( [ $(( $(date +%s) - start )) -lt 4 ] && echo fast || echo slow)"
+
+[ "$nfail" -eq 0 ]
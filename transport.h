@@ -0,0 +1,62 @@
+/*
+ *  Transports used to run commands on hosts.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+#ifndef transport_h
+    #define transport_h
+
+    #include <stdbool.h>
+
+    /* how commands reach a host, run as
+       cmd args... tail... host command */
+    typedef struct {
+        char   *name;   // name given to --transport
+        char   *cmd;    // program to run
+        char  **args;   // default arguments, replaced by --args
+        char  **tail;   // arguments that always follow args
+        char   *noinput;// argument added when commands read no input, NULL if none
+        bool    pool;   // supports the ssh connection pool
+        int     unreachable; // exit status when the host could not be reached, -1 if unknown
+    } transport;
+
+    /*  Find a transport by name, one of ssh, rsh or local.  The local
+        transport runs the command in a local shell with the host name
+        in $SSHALL_HOST, which is useful for testing without a network.
+
+        Args:
+            name:   name of transport.
+
+        Returns:
+            matching transport or NULL if there is none.
+    */
+    const transport *transport_find(const char *name);
+
+#endif
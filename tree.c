@@ -0,0 +1,527 @@
+/*
+ *  Fan out through relay hosts that run sshall themselves.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+// requires gnu compatibility
+#define _GNU_SOURCE
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tree.h"
+#include "debug.h"
+
+#define tree_linemax 256    // longest record header
+#define tree_flush   65536  // bytes of host names buffered before writing
+
+/* hosts handled by one relay */
+typedef struct {
+    char          *relay;   // first host of the list, which relays the rest
+    int            fd;      // host names, one per line
+    unsigned long  base;    // position of the first host in the whole list
+    unsigned long  n;       // number of hosts
+    unsigned long  nseen;   // hosts reported back so far
+    bool          *seen;    // one per host, true once reported
+} tree_branch;
+
+/* record being read from a relay, kept in sched_job.priv */
+typedef struct {
+    char       line[tree_linemax];  // partial header line
+    size_t     linelen;             // number of bytes in line
+    bool       skip;                // true inside a line too long to be a header
+    bool       inframe;             // true while reading the host and output of a record
+    sched_job  leaf;                // host being reported
+    size_t     hostlen;             // length of leaf.host
+    size_t     got;                 // bytes of leaf.host read
+    size_t     outlen;              // bytes of output in the record
+    long long  start_us;            // microseconds from launch of leaf to the record
+    long long  first_us;            // microseconds from first output to the record, -1 if none
+    long long  end_us;              // microseconds from exit of leaf to the record
+} tree_relay;
+
+static tree_branch *tree_branches = NULL;   // one per relay
+static unsigned     tree_n = 0;             // number of relays
+static unsigned     tree_next_relay = 0;    // next relay returned by tree_next
+static unsigned long tree_nlost = 0;        // hosts failed for relays that did not report them
+static void       (*tree_done)(sched_job *j) = NULL;
+
+/*  Write the names buffered for a branch to its list.
+*/
+static void tree_put(tree_branch *b, char *buff, size_t *len)
+{
+    struct iovec iov = {.iov_base = buff, .iov_len = *len};
+
+    if (outbuf_putv(b->fd, &iov, 1) < 0)
+        debug_fail_errno("Failed to write host list");
+
+    *len = 0;
+}
+
+/*  Split the hosts returned by next into at most fanout lists
+    of consecutive hosts.  The first host of each list relays
+    the command to the rest, reading the list on its standard
+    input.
+
+    Args:
+        next:   returns the next host or NULL when done.
+
+        total:  number of hosts next will return.
+
+        fanout: largest number of relays.
+
+        done:   called with each host reported by a relay and
+                with any relay that failed, matching
+                sched_opts.done.
+*/
+void tree_init(char *(*next)(), unsigned long total, unsigned fanout,
+               void (*done)(sched_job *j))
+{
+    unsigned long per = (total + fanout - 1)/fanout, count = 0;
+    char buff[tree_flush];
+    size_t len = 0, hlen;
+    tree_branch *b = NULL;
+    char *host;
+
+    tree_done = done;
+    tree_n = tree_next_relay = 0;
+    tree_nlost = 0;
+
+    if ((tree_branches = calloc(fanout, sizeof(tree_branch))) == NULL)
+        debug_fail_errno("Failed to allocate memory");
+
+    while ((host = next()) != NULL) {
+        // start the next relay
+        if ((b == NULL) || ((b->n == per) && (tree_n < fanout))) {
+            if (b != NULL)
+                tree_put(b, buff, &len);
+
+            b = &tree_branches[tree_n++];
+            b->base = count;
+            if ((b->relay = strdup(host)) == NULL)
+                debug_fail_errno("Failed to allocate memory");
+            if ((b->fd = memfd_create("sshall-hosts", MFD_CLOEXEC)) < 0)
+                debug_fail_errno("Failed to create host list");
+        }
+
+        if (len + (hlen = strlen(host)) + 1 > sizeof(buff))
+            tree_put(b, buff, &len);
+        if (hlen + 1 > sizeof(buff))
+            debug_fail("Host name too long %s", host);
+
+        memcpy(buff+len, host, hlen);
+        buff[len+hlen] = '\n';
+        len += hlen+1;
+
+        ++b->n;
+        ++count;
+    }
+
+    if (b != NULL)
+        tree_put(b, buff, &len);
+
+    for (b = tree_branches; b < tree_branches + tree_n; ++b)
+        if ((b->seen = calloc(b->n, sizeof(bool))) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+
+    debug_print(2, "%lu hosts through %u relays", count, tree_n);
+}
+
+/*  Return the next relay host or NULL when done.  Matches
+    sched_opts.next.
+*/
+char *tree_next()
+{
+    return tree_next_relay < tree_n ? tree_branches[tree_next_relay++].relay : NULL;
+}
+
+/*  Return a new descriptor for the list of hosts of the relay at
+    index, rewound to its start.  Matches sched_opts.input.
+
+    Args:
+        index:  position of the relay.
+*/
+int tree_input(unsigned index)
+{
+    int fd;
+
+    if (index >= tree_n)
+        debug_fail("No host list for relay %u", index);
+
+    // a retried relay reads its list again
+    if (lseek(tree_branches[index].fd, 0, SEEK_SET) < 0)
+        debug_fail_errno("Failed to rewind host list");
+
+    if ((fd = dup(tree_branches[index].fd)) < 0)
+        debug_fail_errno("Failed to duplicate host list");
+
+    return fd;
+}
+
+/*  Microseconds from a to b.
+*/
+static long long tree_us(const struct timespec *a, const struct timespec *b)
+{
+    return (b->tv_sec - a->tv_sec)*1000000LL + (b->tv_nsec - a->tv_nsec)/1000;
+}
+
+/*  The time us microseconds before t.
+*/
+static struct timespec tree_before(const struct timespec *t, long long us)
+{
+    struct timespec r;
+
+    r.tv_sec  = t->tv_sec - us/1000000;
+    r.tv_nsec = t->tv_nsec - (us%1000000)*1000;
+    if (r.tv_nsec < 0) {
+        r.tv_nsec += 1000000000L;
+        --r.tv_sec;
+    }
+
+    return r;
+}
+
+/*  Parse a complete header line, starting a record, or keep
+    the line as output of the relay.
+*/
+static void tree_header(sched_job *j, tree_relay *r)
+{
+    const size_t marklen = strlen(tree_mark);
+    size_t hostlen, outlen, nout, nerr;
+    long long start_us, first_us, end_us, utime, stime;
+    int status, timedout, cancelled, end = 0;
+    unsigned index, attempt;
+    long maxrss;
+
+    r->line[r->linelen] = '\0';
+
+    if ((r->linelen > marklen) && (memcmp(r->line, tree_mark, marklen) == 0) &&
+            (sscanf(r->line+marklen, " %u %d %d %d %u %lld %lld %lld %zu %zu %lld %lld %ld %zu %zu%n",
+                    &index, &status, &timedout, &cancelled, &attempt, &start_us, &first_us,
+                    &end_us, &nout, &nerr, &utime, &stime, &maxrss, &hostlen, &outlen,
+                    &end) == 15) &&
+            (r->line[marklen+end] == '\n') && (hostlen > 0)) {
+        memset(&r->leaf, 0, sizeof(r->leaf));
+        outbuf_init(&r->leaf.out);
+        if ((r->leaf.host = malloc(hostlen+1)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        r->leaf.host[hostlen] = '\0';
+        r->leaf.index     = index;
+        r->leaf.status    = status;
+        r->leaf.timedout  = timedout != 0;
+        r->leaf.cancelled = cancelled != 0;
+        r->leaf.attempt   = attempt;
+        r->leaf.nbytes[sched_out] = nout;
+        r->leaf.nbytes[sched_err] = nerr;
+        r->leaf.usage.ru_utime.tv_sec  = utime/1000000;
+        r->leaf.usage.ru_utime.tv_usec = utime%1000000;
+        r->leaf.usage.ru_stime.tv_sec  = stime/1000000;
+        r->leaf.usage.ru_stime.tv_usec = stime%1000000;
+        r->leaf.usage.ru_maxrss = maxrss;
+        r->start_us = start_us;
+        r->first_us = first_us;
+        r->end_us   = end_us;
+        r->hostlen = hostlen;
+        r->outlen  = outlen;
+        r->got     = 0;
+        r->inframe = true;
+    }
+    else
+        outbuf_append(&j->out, r->line, r->linelen);
+
+    r->linelen = 0;
+}
+
+/*  Hand the host of a complete record to tree_done.
+*/
+static void tree_deliver(sched_job *j, tree_relay *r)
+{
+    tree_branch *b = &tree_branches[j->index];
+    sched_job *leaf = &r->leaf;
+
+    struct timespec now;
+
+    // each host of the list is reported once
+    if ((leaf->index >= b->n) || b->seen[leaf->index])
+        debug_warn("Relay %s reported host %u of %lu twice or out of range, dropping it",
+                   j->host, leaf->index, b->n);
+
+    // positions are relative to the list of the relay and times
+    // to when the record was sent, as the clocks of relays are their own
+    else {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        b->seen[leaf->index] = true;
+        ++b->nseen;
+        leaf->index += b->base;
+        leaf->start = tree_before(&now, r->start_us);
+        leaf->end   = tree_before(&now, r->end_us);
+        if (r->first_us >= 0)
+            leaf->first = tree_before(&now, r->first_us);
+
+        tree_done(leaf);
+    }
+
+    // free whatever done did not take
+    free(leaf->host);
+    outbuf_free(&leaf->out);
+    leaf->host = NULL;
+    r->inframe = false;
+}
+
+/*  Parse the records sent back by a relay and pass each host
+    they hold to done as it completes.  Anything else a relay
+    prints is kept as its own output.  Matches sched_opts.output.
+
+    Args:
+        j:      relay that produced the output.
+
+        s:      stream the output was read from.
+
+        data:   output read from the relay.
+
+        len:    number of bytes in data.
+*/
+void tree_output(sched_job *j, sched_stream s, const char *data, size_t len)
+{
+    tree_relay *r = j->priv;
+    const char *nl;
+    size_t n;
+
+    if (s == sched_err) {
+        outbuf_append(&j->out, data, len);
+        return;
+    }
+
+    if ((r == NULL) && ((r = j->priv = calloc(1, sizeof(tree_relay))) == NULL))
+        debug_fail_errno("Failed to allocate memory");
+
+    while (len > 0) {
+        if (r->inframe) {
+            if (r->got < r->hostlen) {
+                n = len < r->hostlen - r->got ? len : r->hostlen - r->got;
+                memcpy(r->leaf.host + r->got, data, n);
+                r->got += n;
+            }
+            else {
+                n = len < r->outlen - r->leaf.out.len ? len : r->outlen - r->leaf.out.len;
+                outbuf_append(&r->leaf.out, data, n);
+            }
+        }
+
+        else {
+            nl = memchr(data, '\n', len);
+            n = nl != NULL ? (size_t)(nl - data) + 1 : len;
+
+            // too long for a header, pass it through up to the newline
+            if (r->skip || (r->linelen + n >= sizeof(r->line))) {
+                outbuf_append(&j->out, r->line, r->linelen);
+                outbuf_append(&j->out, data, n);
+                r->linelen = 0;
+                r->skip = nl == NULL;
+            }
+            else {
+                memcpy(r->line + r->linelen, data, n);
+                r->linelen += n;
+                if (nl != NULL)
+                    tree_header(j, r);
+            }
+        }
+
+        data += n;
+        len  -= n;
+
+        if (r->inframe && (r->got == r->hostlen) && (r->leaf.out.len == r->outlen))
+            tree_deliver(j, r);
+    }
+}
+
+/*  Pass every host of the list of b that relay j did not report
+    to done as failed with the status of the relay, or cancelled
+    along with it, each at its own position.
+*/
+static void tree_lost(tree_branch *b, const sched_job *j)
+{
+    struct stat st;
+    sched_job leaf;
+    unsigned long i;
+    char *list, *host, *nl, *why;
+    int len;
+
+    if ((fstat(b->fd, &st) < 0) ||
+            ((list = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, b->fd, 0)) == MAP_FAILED))
+        debug_fail_errno("Failed to read host list");
+
+    for (i = 0, host = list; i < b->n; ++i, host = nl+1) {
+        nl = memchr(host, '\n', list + st.st_size - host);
+
+        if (b->seen[i])
+            continue;
+
+        memset(&leaf, 0, sizeof(leaf));
+        outbuf_init(&leaf.out);
+        if ((leaf.host = strndup(host, nl - host)) == NULL)
+            debug_fail_errno("Failed to allocate memory");
+        leaf.index     = b->base + i;
+        leaf.status    = j->status != 0 ? j->status : W_EXITCODE(EXIT_FAILURE, 0);
+        leaf.timedout  = j->timedout;
+        leaf.cancelled = j->cancelled;
+        leaf.start     = j->start;
+        leaf.end       = j->end;
+        leaf.reaped    = true;
+        if ((len = asprintf(&why, "not reported by relay %s\n", j->host)) < 0)
+            debug_fail_errno("Failed to allocate memory");
+        outbuf_append(&leaf.out, why, len);
+        free(why);
+
+        if (!leaf.cancelled)
+            ++tree_nlost;
+
+        tree_done(&leaf);
+
+        free(leaf.host);
+        outbuf_free(&leaf.out);
+    }
+
+    munmap(list, st.st_size);
+}
+
+/*  Pass a finished relay to done if it failed or printed anything
+    other than records, and each host it did not report as failed,
+    then free what it held.  Matches sched_opts.done.
+
+    Args:
+        j:  finished relay.
+*/
+void tree_finish(sched_job *j)
+{
+    tree_branch *b = &tree_branches[j->index];
+    tree_relay *r = j->priv;
+    char *name;
+
+    if (r != NULL) {
+        outbuf_append(&j->out, r->line, r->linelen);
+        if (r->inframe) {
+            free(r->leaf.host);
+            outbuf_free(&r->leaf.out);
+        }
+        free(r);
+        j->priv = NULL;
+    }
+
+    if ((j->status == 0) && (j->out.len == 0) && (b->nseen == b->n))
+        return;
+
+    if (b->nseen < b->n) {
+        debug_warn("Relay %s reported %lu of %lu hosts", j->host, b->nseen, b->n);
+        tree_lost(b, j);
+    }
+
+    // not to be mistaken for the report of the relay as a host,
+    // nor take the place of a host printed in input order
+    if (asprintf(&name, "%s (relay)", j->host) < 0)
+        debug_fail_errno("Failed to allocate memory");
+    free(j->host);
+    j->host  = name;
+    j->index = sched_noindex;
+
+    tree_done(j);
+}
+
+/*  Number of hosts passed to done as failed because their relay
+    did not report them.
+*/
+unsigned long tree_nfailed()
+{
+    return tree_nlost;
+}
+
+/*  Free every list of hosts.
+*/
+void tree_free()
+{
+    unsigned i;
+
+    for (i = 0; i < tree_n; ++i) {
+        close(tree_branches[i].fd);
+        free(tree_branches[i].relay);
+        free(tree_branches[i].seen);
+    }
+
+    free(tree_branches);
+    tree_branches = NULL;
+    tree_n = tree_next_relay = 0;
+}
+
+/*  Send a finished host back to the parent as a record on
+    standard output.  Used by relays in place of printing.
+    The record carries the status, retries, timing and resource
+    usage of the host, with times relative to when it is sent.
+    Matches sched_opts.done.
+
+    Args:
+        j:  finished host.
+*/
+void tree_frame(sched_job *j)
+{
+    bool out = (j->first.tv_sec != 0) || (j->first.tv_nsec != 0);
+    struct timespec now;
+    struct iovec head;
+    char *rec;
+    int r;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    if ((r = asprintf(&rec, "%s %u %d %d %d %u %lld %lld %lld %zu %zu %lld %lld %ld %zu %zu\n%s",
+                      tree_mark, j->index, j->status, j->timedout, j->cancelled, j->attempt,
+                      tree_us(&j->start, &now), out ? tree_us(&j->first, &now) : -1LL,
+                      tree_us(&j->end, &now),
+                      j->nbytes[sched_out], j->nbytes[sched_err],
+                      j->usage.ru_utime.tv_sec*1000000LL + j->usage.ru_utime.tv_usec,
+                      j->usage.ru_stime.tv_sec*1000000LL + j->usage.ru_stime.tv_usec,
+                      j->usage.ru_maxrss, strlen(j->host), j->out.len, j->host)) < 0)
+        debug_fail_errno("Failed to allocate memory");
+
+    head.iov_base = rec;
+    head.iov_len  = r;
+
+    if (outbuf_write(&j->out, STDOUT_FILENO, &head, NULL) < 0)
+        debug_fail_errno("Failed to write record");
+
+    free(rec);
+}
@@ -0,0 +1,120 @@
+/*
+ *  Fan out through relay hosts that run sshall themselves.
+ */
+
+/*****************************************************************************\
+* Copyright (c) 2017, Elliott Forney, http://www.elliottforney.com            *
+* All rights reserved.                                                        *
+*                                                                             *
+* Redistribution and use in source and binary forms, with or without          *
+* modification, are permitted provided that the following conditions are met: *
+*                                                                             *
+* 1. Redistributions of source code must retain the above copyright notice,   *
+*    this list of conditions and the following disclaimer.                    *
+*                                                                             *
+* 2. Redistributions in binary form must reproduce the above copyright        *
+*    notice, this list of conditions and the following disclaimer in the      *
+*    documentation and/or other materials provided with the distribution.     *
+*                                                                             *
+* THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" *
+* AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   *
+* IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  *
+* ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE   *
+* LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR         *
+* CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF        *
+* SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS    *
+* INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN     *
+* CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)     *
+* ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  *
+* POSSIBILITY OF SUCH DAMAGE.                                                 *
+\*****************************************************************************/
+
+
+
+#ifndef tree_h
+    #define tree_h
+
+    #include <stddef.h>
+
+    #include "sched.h"
+
+    /* line starting each record sent back by a relay */
+    #define tree_mark "@@sshall-frame@@"
+
+    /*  Split the hosts returned by next into at most fanout lists
+        of consecutive hosts.  The first host of each list relays
+        the command to the rest, reading the list on its standard
+        input.
+
+        Args:
+            next:   returns the next host or NULL when done.
+
+            total:  number of hosts next will return.
+
+            fanout: largest number of relays.
+
+            done:   called with each host reported by a relay and
+                    with any relay that failed, matching
+                    sched_opts.done.
+    */
+    void tree_init(char *(*next)(), unsigned long total, unsigned fanout,
+                   void (*done)(sched_job *j));
+
+    /*  Return the next relay host or NULL when done.  Matches
+        sched_opts.next.
+    */
+    char *tree_next();
+
+    /*  Return a new descriptor for the list of hosts of the relay at
+        index, rewound to its start.  Matches sched_opts.input.
+
+        Args:
+            index:  position of the relay.
+    */
+    int tree_input(unsigned index);
+
+    /*  Parse the records sent back by a relay and pass each host
+        they hold to done as it completes.  Anything else a relay
+        prints is kept as its own output.  Matches sched_opts.output.
+
+        Args:
+            j:      relay that produced the output.
+
+            s:      stream the output was read from.
+
+            data:   output read from the relay.
+
+            len:    number of bytes in data.
+    */
+    void tree_output(sched_job *j, sched_stream s, const char *data, size_t len);
+
+    /*  Pass a finished relay to done if it failed or printed anything
+        other than records, and each host it did not report as failed,
+        then free what it held.  Matches sched_opts.done.
+
+        Args:
+            j:  finished relay.
+    */
+    void tree_finish(sched_job *j);
+
+    /*  Number of hosts passed to done as failed because their relay
+        did not report them.
+    */
+    unsigned long tree_nfailed();
+
+    /*  Free every list of hosts.
+    */
+    void tree_free();
+
+    /*  Send a finished host back to the parent as a record on
+        standard output.  Used by relays in place of printing.
+        The record carries the status, retries, timing and resource
+        usage of the host, with times relative to when it is sent.
+        Matches sched_opts.done.
+
+        Args:
+            j:  finished host.
+    */
+    void tree_frame(sched_job *j);
+
+#endif